@@ -0,0 +1,216 @@
+#include "aabbtree.h"
+
+#include <algorithm>
+
+static LandBox merge(const LandBox &a, const LandBox &b) {
+  LandBox r;
+  r.X1 = std::min(a.X1, b.X1);
+  r.Y1 = std::min(a.Y1, b.Y1);
+  r.Z1 = std::min(a.Z1, b.Z1);
+  r.X2 = std::max(a.X2, b.X2);
+  r.Y2 = std::max(a.Y2, b.Y2);
+  r.Z2 = std::max(a.Z2, b.Z2);
+  return r;
+}
+
+static double area(const LandBox &box) {
+  double x = (double) box.X2 - box.X1 + 1;
+  double y = (double) box.Y2 - box.Y1 + 1;
+  double z = (double) box.Z2 - box.Z1 + 1;
+
+  return 2.0 * (x * y + y * z + z * x);
+}
+
+int32_t AabbTree::allocate() {
+  if (freeList == kNull) {
+    nodes.emplace_back();
+    return (int32_t) nodes.size() - 1;
+  }
+
+  int32_t node = freeList;
+  freeList     = nodes[node].parent;
+  nodes[node]  = Node();
+  return node;
+}
+
+void AabbTree::release(int32_t node) {
+  nodes[node].parent = freeList;
+  nodes[node].height = -1;
+  freeList           = node;
+}
+
+void AabbTree::Clear() {
+  nodes.clear();
+  root     = kNull;
+  freeList = kNull;
+  count    = 0;
+}
+
+int32_t AabbTree::Insert(const LandBox &box, uint32_t slot) {
+  int32_t leaf     = allocate();
+  nodes[leaf].box  = box;
+  nodes[leaf].slot = slot;
+  insertLeaf(leaf);
+  count++;
+  return leaf;
+}
+
+void AabbTree::Remove(int32_t leaf) {
+  removeLeaf(leaf);
+  release(leaf);
+  count--;
+}
+
+void AabbTree::insertLeaf(int32_t leaf) {
+  if (root == kNull) {
+    root               = leaf;
+    nodes[leaf].parent = kNull;
+    return;
+  }
+
+  // Walk down choosing the child whose surface area grows the least
+  const LandBox box = nodes[leaf].box;
+  int32_t index     = root;
+
+  while (!nodes[index].IsLeaf()) {
+    const Node &node = nodes[index];
+
+    double nodeArea     = area(node.box);
+    double combinedArea = area(merge(node.box, box));
+
+    // Cost of pairing the new leaf with this node, and the cost pushed down to the children
+    double cost        = 2.0 * combinedArea;
+    double inheritance = 2.0 * (combinedArea - nodeArea);
+
+    auto descend = [&](int32_t child) {
+      const Node &c = nodes[child];
+      double grown  = area(merge(c.box, box));
+      return c.IsLeaf() ? grown + inheritance : grown - area(c.box) + inheritance;
+    };
+
+    double costLeft  = descend(node.left);
+    double costRight = descend(node.right);
+
+    if (cost < costLeft && cost < costRight) break;
+
+    index = costLeft < costRight ? node.left : node.right;
+  }
+
+  int32_t sibling   = index;
+  int32_t oldParent = nodes[sibling].parent;
+  int32_t newParent = allocate();
+
+  nodes[newParent].parent = oldParent;
+  nodes[newParent].box    = merge(box, nodes[sibling].box);
+  nodes[newParent].height = nodes[sibling].height + 1;
+  nodes[newParent].left   = sibling;
+  nodes[newParent].right  = leaf;
+  nodes[sibling].parent   = newParent;
+  nodes[leaf].parent      = newParent;
+
+  if (oldParent == kNull) {
+    root = newParent;
+  } else if (nodes[oldParent].left == sibling) {
+    nodes[oldParent].left = newParent;
+  } else {
+    nodes[oldParent].right = newParent;
+  }
+
+  refit(nodes[leaf].parent);
+}
+
+void AabbTree::removeLeaf(int32_t leaf) {
+  if (leaf == root) {
+    root = kNull;
+    return;
+  }
+
+  int32_t parent      = nodes[leaf].parent;
+  int32_t grandParent = nodes[parent].parent;
+  int32_t sibling     = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+  if (grandParent == kNull) {
+    root                  = sibling;
+    nodes[sibling].parent = kNull;
+    release(parent);
+    return;
+  }
+
+  // Replace the parent with the sibling and shrink the ancestors
+  if (nodes[grandParent].left == parent) {
+    nodes[grandParent].left = sibling;
+  } else {
+    nodes[grandParent].right = sibling;
+  }
+
+  nodes[sibling].parent = grandParent;
+  release(parent);
+
+  refit(grandParent);
+}
+
+void AabbTree::refit(int32_t index) {
+  while (index != kNull) {
+    index = balance(index);
+
+    Node &node  = nodes[index];
+    node.box    = merge(nodes[node.left].box, nodes[node.right].box);
+    node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+
+    index = node.parent;
+  }
+}
+
+// Performs a left or right rotation if the node is imbalanced, returns the new subtree root
+int32_t AabbTree::balance(int32_t iA) {
+  Node &A = nodes[iA];
+  if (A.IsLeaf() || A.height < 2) return iA;
+
+  int32_t iB = A.left;
+  int32_t iC = A.right;
+
+  int32_t diff = nodes[iC].height - nodes[iB].height;
+
+  // Rotate the taller child up, its shorter grandchild moves down to A
+  auto rotate = [&](int32_t iUp, int32_t iOther, bool upIsRight) {
+    Node &up   = nodes[iUp];
+    int32_t iF = up.left;
+    int32_t iG = up.right;
+
+    up.left   = iA;
+    up.parent = A.parent;
+    A.parent  = iUp;
+
+    if (up.parent == kNull) {
+      root = iUp;
+    } else if (nodes[up.parent].left == iA) {
+      nodes[up.parent].left = iUp;
+    } else {
+      nodes[up.parent].right = iUp;
+    }
+
+    int32_t keep = nodes[iF].height > nodes[iG].height ? iF : iG;
+    int32_t move = keep == iF ? iG : iF;
+
+    up.right           = keep;
+    nodes[move].parent = iA;
+
+    if (upIsRight) {
+      A.right = move;
+    } else {
+      A.left = move;
+    }
+
+    A.box     = merge(nodes[iOther].box, nodes[move].box);
+    A.height  = 1 + std::max(nodes[iOther].height, nodes[move].height);
+    up.box    = merge(A.box, nodes[keep].box);
+    up.height = 1 + std::max(A.height, nodes[keep].height);
+
+    return iUp;
+  };
+
+  if (diff > 1) return rotate(iC, iB, true);
+  if (diff < -1) return rotate(iB, iC, false);
+
+  return iA;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+
+#include "landbox.h"
+
+// Dynamic bounding volume hierarchy over land boxes.
+//
+// Leaves hold the slot of one land each, inner nodes hold the union of their children. Insertion descends by the
+// cheapest surface area growth and the tree is kept height balanced with rotations, so box queries cost O(log n + k)
+// regardless of how many chunks a land spans.
+class AabbTree {
+public:
+  static constexpr int32_t kNull = -1;
+
+  int32_t Insert(const LandBox &box, uint32_t slot);
+  void Remove(int32_t leaf);
+  void Clear();
+
+  inline size_t Size() const { return count; }
+  inline int Height() const { return root == kNull ? 0 : nodes[root].height; }
+
+  // Calls f(slot, box) for every leaf intersecting the box, stops as soon as f returns false
+  template <typename F> void Query(const LandBox &box, F f) const {
+    if (root == kNull) return;
+
+    int32_t stack[kMaxDepth];
+    int top      = 0;
+    stack[top++] = root;
+
+    while (top > 0) {
+      const Node &node = nodes[stack[--top]];
+      if (!node.box.Intersects(box)) continue;
+
+      if (node.IsLeaf()) {
+        if (!f(node.slot, node.box)) return;
+      } else {
+        stack[top++] = node.left;
+        stack[top++] = node.right;
+      }
+    }
+  }
+
+  // Calls f(slot, box, distance) for every leaf, nearest to the block first, with the squared distance to the closest
+  // block of its box. Stops as soon as f returns false. Nodes wait in a heap ordered by how close their box comes, so a
+  // leaf is only reported once nothing left can be closer and the work grows with the leaves reported, not the tree.
+  template <typename F> void Nearest(const int x, const int y, const int z, F f) const {
+    if (root == kNull) return;
+
+    std::vector<std::pair<int64_t, int32_t>> heap;
+    heap.emplace_back(nodes[root].box.DistanceSquared(x, y, z), root);
+
+    while (!heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+      auto [distance, index] = heap.back();
+      heap.pop_back();
+
+      const Node &node = nodes[index];
+
+      if (node.IsLeaf()) {
+        if (!f(node.slot, node.box, distance)) return;
+        continue;
+      }
+
+      for (int32_t child : {node.left, node.right}) {
+        heap.emplace_back(nodes[child].box.DistanceSquared(x, y, z), child);
+        std::push_heap(heap.begin(), heap.end(), std::greater<>());
+      }
+    }
+  }
+
+private:
+  // AVL balancing keeps the height under 1.44 log2(n), this covers far more lands than fit in memory
+  static constexpr int kMaxDepth = 128;
+
+  struct Node {
+    LandBox box;
+    uint32_t slot  = 0;
+    int32_t parent = kNull;
+    int32_t left   = kNull;
+    int32_t right  = kNull;
+    int32_t height = 0;
+
+    inline bool IsLeaf() const { return left == kNull; }
+  };
+
+  int32_t allocate();
+  void release(int32_t node);
+  void insertLeaf(int32_t leaf);
+  void removeLeaf(int32_t leaf);
+  int32_t balance(int32_t node);
+  void refit(int32_t node);
+
+  std::vector<Node> nodes;
+  int32_t root     = kNull;
+  int32_t freeList = kNull;
+  size_t count     = 0;
+};
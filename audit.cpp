@@ -0,0 +1,382 @@
+#include "audit.h"
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <unordered_set>
+
+#include "database.h"
+
+DEF_LOGGER("LandManager");
+
+namespace {
+
+// Lands a worker takes at a time, a few large lands with long sweeps do not hold the others up
+constexpr size_t kSweepBlock = 4096;
+
+// Report a worker collects before writing it out
+constexpr size_t kFlushBytes = 1 << 16;
+
+// Lands changed per transaction, the writer commits them in batches of the same size
+constexpr size_t kBatchLands = 512;
+
+// Lands the writer may fall behind by before the audit waits for it
+constexpr size_t kMaxBacklog = 4096;
+
+constexpr std::chrono::milliseconds kWriterTimeout = std::chrono::seconds(30);
+
+// Times the owner totals are read back before giving up on a busy server
+constexpr int kMaxAttempts = 8;
+
+enum Fate : uint8_t { Kept, Sold, Shrunk };
+
+struct AuditLand {
+  LandBox box;
+
+  // Box as stored, before the audit cut it back
+  LandBox claimed;
+  int32_t dim;
+  int32_t depth;
+  int64_t id;
+  uint64_t owner;
+
+  // Milliseconds since the epoch it was claimed at
+  int64_t created;
+
+  Fate fate;
+};
+
+// Positions in the sorted lands, only kept when a policy has to act on them
+using Pair = std::pair<uint32_t, uint32_t>;
+
+inline bool nested(const AuditLand &outer, const AuditLand &inner) {
+  return inner.depth > outer.depth && outer.box.Contains(inner.box);
+}
+
+inline bool conflict(const AuditLand &a, const AuditLand &b) {
+  return a.box.Intersects(b.box) && !nested(a, b) && !nested(b, a);
+}
+
+// Claimed first, the lower id breaks ties
+inline bool older(const AuditLand &a, const AuditLand &b) {
+  return a.created != b.created ? a.created < b.created : a.id < b.id;
+}
+
+void load(std::vector<AuditLand> &lands) {
+  SQLite::Statement stmt{
+      *landDB, "SELECT id, owner, dim, x1, y1, z1, x2, y2, z2, depth, "
+               "IFNULL(CAST(ROUND((julianday(created_at) - 2440587.5) * 86400000) AS INTEGER), 0) FROM lands"};
+
+  while (stmt.executeStep()) {
+    AuditLand land;
+    land.id      = stmt.getColumn(0).getInt64();
+    land.owner   = stmt.getColumn(1).getInt64();
+    land.dim     = stmt.getColumn(2).getInt();
+    land.box     = LandBox(
+        stmt.getColumn(3).getInt(), stmt.getColumn(4).getInt(), stmt.getColumn(5).getInt(),
+        stmt.getColumn(6).getInt(), stmt.getColumn(7).getInt(), stmt.getColumn(8).getInt());
+    land.depth   = stmt.getColumn(9).getInt();
+    land.created = stmt.getColumn(10).getInt64();
+    land.claimed = land.box;
+    land.fate    = Kept;
+
+    lands.push_back(land);
+  }
+}
+
+// Sweep and prune along x. With the lands sorted by dimension and X1, a land is only compared with the ones after it
+// that start inside its x range, so every pair is found exactly once. Workers take blocks of lands from a shared
+// counter and write their part of the report as it fills up, if there is one. Sold lands are left out.
+int64_t sweep(const std::vector<AuditLand> &lands, int threads, std::FILE *out, std::vector<Pair> *pairs) {
+  std::mutex outMutex;
+  std::atomic<size_t> next{0};
+  std::atomic<int64_t> found{0};
+  std::vector<std::vector<Pair>> kept(threads);
+
+  auto work = [&](int worker) {
+    std::string buffer;
+    int64_t count = 0;
+
+    auto flush = [&] {
+      std::lock_guard lock(outMutex);
+      std::fwrite(buffer.data(), 1, buffer.size(), out);
+      buffer.clear();
+    };
+
+    for (size_t begin = next.fetch_add(kSweepBlock); begin < lands.size(); begin = next.fetch_add(kSweepBlock)) {
+      size_t end = std::min(begin + kSweepBlock, lands.size());
+
+      for (size_t i = begin; i < end; i++) {
+        const AuditLand &a = lands[i];
+        if (a.fate == Sold) continue;
+
+        for (size_t j = i + 1; j < lands.size() && lands[j].dim == a.dim && lands[j].box.X1 <= a.box.X2; j++) {
+          const AuditLand &b = lands[j];
+          if (b.fate == Sold || !conflict(a, b)) continue;
+
+          count++;
+
+          if (pairs) kept[worker].emplace_back((uint32_t) i, (uint32_t) j);
+          if (!out) continue;
+
+          LandBox shared = a.box.Clip(b.box);
+          char line[160];
+          int length = std::snprintf(
+              line, sizeof(line), "%lld,%lld,%d,%d,%d,%d,%d,%d,%d\n", (long long) a.id, (long long) b.id, a.dim,
+              shared.X1, shared.Y1, shared.Z1, shared.X2, shared.Y2, shared.Z2);
+
+          buffer.append(line, std::min<size_t>(length, sizeof(line) - 1));
+        }
+
+        if (buffer.size() >= kFlushBytes) flush();
+      }
+    }
+
+    if (!buffer.empty()) flush();
+    found += count;
+  };
+
+  std::vector<std::thread> workers;
+  for (int worker = 1; worker < threads; worker++) workers.emplace_back(work, worker);
+
+  work(0);
+  for (std::thread &thread : workers) thread.join();
+
+  for (std::vector<Pair> &part : kept) {
+    if (pairs) pairs->insert(pairs->end(), part.begin(), part.end());
+  }
+
+  return found;
+}
+
+// Cuts b out of a along the face that keeps the most of it, false when every face leaves nothing
+bool cut(LandBox &a, const LandBox &b) {
+  LandBox cuts[6] = {a, a, a, a, a, a};
+  bool fits[6]    = {b.X1 > a.X1, b.X2 < a.X2, b.Y1 > a.Y1, b.Y2 < a.Y2, b.Z1 > a.Z1, b.Z2 < a.Z2};
+
+  cuts[0].X2 = b.X1 - 1;
+  cuts[1].X1 = b.X2 + 1;
+  cuts[2].Y2 = b.Y1 - 1;
+  cuts[3].Y1 = b.Y2 + 1;
+  cuts[4].Z2 = b.Z1 - 1;
+  cuts[5].Z1 = b.Z2 + 1;
+
+  int best = -1;
+
+  for (int i = 0; i < 6; i++) {
+    if (fits[i] && (best < 0 || cuts[i].Volume() > cuts[best].Volume())) best = i;
+  }
+
+  if (best < 0) return false;
+
+  a = cuts[best];
+  return true;
+}
+
+// Every later land is decided against the earlier ones it cut into, in claim order, so the earlier ones are already
+// final. Shrinking only gives blocks up. A sub-zone left sticking out of a land cut back around it is clipped to
+// what is left of that land instead, whichever was claimed first.
+void resolve(std::vector<AuditLand> &lands, std::vector<Pair> &pairs, AuditPolicy policy) {
+  for (Pair &pair : pairs) {
+    const AuditLand &a = lands[pair.first];
+    const AuditLand &b = lands[pair.second];
+
+    if (older(a, b) || (b.depth < a.depth && b.claimed.Contains(a.box))) std::swap(pair.first, pair.second);
+  }
+
+  std::sort(pairs.begin(), pairs.end(), [&](const Pair &a, const Pair &b) {
+    if (a.first == b.first) return older(lands[a.second], lands[b.second]);
+    return older(lands[a.first], lands[b.first]);
+  });
+
+  for (const Pair &pair : pairs) {
+    AuditLand &later   = lands[pair.first];
+    AuditLand &earlier = lands[pair.second];
+
+    if (later.fate == Sold || earlier.fate == Sold || !conflict(later, earlier)) continue;
+
+    if (later.depth > earlier.depth && earlier.claimed.Contains(later.box)) {
+      later.box  = later.box.Clip(earlier.box);
+      later.fate = Shrunk;
+    } else if (policy == AuditPolicy::Shrink && cut(later.box, earlier.box)) {
+      later.fate = Shrunk;
+    } else {
+      later.fate = Sold;
+    }
+  }
+}
+
+// A shrunk land is resized in place, its owner, trusted players, claim date and rent deadline stay
+bool apply(const std::vector<AuditLand> &lands, std::FILE *out, AuditReport &report) {
+  size_t batch = 0;
+  std::optional<LandManager::Transaction> trans;
+
+  for (const AuditLand &land : lands) {
+    if (land.fate == Kept) continue;
+    if (!trans) trans.emplace();
+
+    LandMutation mutation;
+    mutation.land.id = land.id;
+
+    if (land.fate == Sold) {
+      mutation.kind = LandMutation::Kind::Erase;
+      LandManager::Submit(mutation);
+
+      std::fprintf(out, "# sold %lld\n", (long long) land.id);
+      report.erased++;
+    } else {
+      mutation.kind       = LandMutation::Kind::Resize;
+      mutation.land.owner = land.owner;
+      mutation.land.dim   = land.dim;
+      mutation.land.box   = land.box;
+      mutation.land.depth = land.depth;
+      LandManager::Submit(mutation);
+
+      std::fprintf(
+          out, "# shrunk %lld to %d,%d,%d,%d,%d,%d\n", (long long) land.id, land.box.X1, land.box.Y1, land.box.Z1,
+          land.box.X2, land.box.Y2, land.box.Z2);
+      report.shrunk++;
+    }
+
+    if (++batch < kBatchLands) continue;
+
+    trans->Commit();
+    trans.reset();
+    batch = 0;
+
+    // The journal and the queue hold everything the writer has not stored yet, keep them small
+    if (!LandManager::WaitForWriter(kMaxBacklog, kWriterTimeout)) return false;
+  }
+
+  if (trans) trans->Commit();
+  return true;
+}
+
+// Lands that were not resident were changed without the index seeing their old box, so the totals of every owner
+// that lost or shrank a land are read back once the writer stored it all. Mutations applied in between make the
+// table stale, it is read again then.
+bool reloadTotals(const std::vector<AuditLand> &lands) {
+  static SQLite::Statement stmt{
+      *landDB,
+      "SELECT COUNT(*), IFNULL(SUM((x2 - x1 + 1) * (y2 - y1 + 1) * (z2 - z1 + 1)), 0) FROM lands WHERE owner = ?"};
+
+  std::unordered_set<uint64_t> changed;
+
+  for (const AuditLand &land : lands) {
+    if (land.fate != Kept) changed.insert(land.owner);
+  }
+
+  for (int attempt = 0; attempt < kMaxAttempts; attempt++) {
+    // Taken first, whatever the index had applied by then is stored once the writer drained
+    uint64_t since = landIndex.Read()->Changes();
+    if (!LandManager::WaitForWriter(0, kWriterTimeout)) return false;
+    std::vector<std::pair<uint64_t, OwnerTotals>> totals;
+
+    for (uint64_t owner : changed) {
+      BOOST_SCOPE_EXIT_ALL() {
+        stmt.clearBindings();
+        stmt.tryReset();
+      };
+
+      stmt.bind(1, (int64_t) owner);
+      stmt.executeStep();
+
+      OwnerTotals read;
+      read.lands  = stmt.getColumn(0).getInt();
+      read.volume = stmt.getColumn(1).getInt64();
+      totals.emplace_back(owner, read);
+    }
+
+    bool current = false;
+
+    landIndex.Write([&](LandIndex &index) {
+      if (index.Changes() != since) return;
+
+      current = true;
+      for (auto &[owner, read] : totals) index.SetTotals(owner, read);
+    });
+
+    if (current) return true;
+  }
+
+  return false;
+}
+
+} // namespace
+
+std::optional<std::string> LandManager::AuditLands(
+    const std::string &path, AuditPolicy policy, int threads, AuditReport &report) {
+  if (!LandManager::WaitForWriter(0, kWriterTimeout)) {
+    return "[Zonas] La base de datos esta ocupada, intenta de nuevo mas tarde.";
+  }
+
+  std::FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) return "[Zonas] No se pudo abrir el archivo " + path + ".";
+
+  BOOST_SCOPE_EXIT_ALL(&) { std::fclose(file); };
+
+  std::vector<AuditLand> lands;
+
+  try {
+    load(lands);
+  } catch (SQLite::Exception const &ex) {
+    LOGE("[LM] Failed to read lands for the audit: %s") % ex.what();
+    return "[Zonas] Ocurrio un error al leer las zonas.";
+  }
+
+  auto byX = [](const AuditLand &a, const AuditLand &b) {
+    return a.dim != b.dim ? a.dim < b.dim : a.box.X1 < b.box.X1;
+  };
+
+  std::sort(lands.begin(), lands.end(), byX);
+
+  if (threads <= 0) threads = (int) std::max(1u, std::thread::hardware_concurrency());
+
+  std::fputs("land_a,land_b,dim,x1,y1,z1,x2,y2,z2\n", file);
+
+  std::vector<Pair> pairs;
+  report.lands = (int64_t) lands.size();
+  report.pairs = sweep(lands, threads, file, policy == AuditPolicy::Flag ? nullptr : &pairs);
+
+  if (!pairs.empty()) {
+    // Cutting a land back can leave its sub-zones sticking out, sweep what is left until nothing cuts into anything.
+    // Every round only gives blocks up, so it ends.
+    for (;;) {
+      resolve(lands, pairs, policy);
+      pairs.clear();
+
+      if (policy != AuditPolicy::Shrink) break;
+
+      std::sort(lands.begin(), lands.end(), byX);
+      if (!sweep(lands, threads, nullptr, &pairs)) break;
+    }
+
+    // The pairs are not needed any more, there can be far more of them than lands
+    std::vector<Pair>().swap(pairs);
+
+    if (!apply(lands, file, report)) {
+      LOGE("[LM] Audit stopped after selling %d and shrinking %d lands, the writer is not keeping up") %
+          report.erased % report.shrunk;
+      return "[Zonas] La base de datos no responde, la auditoria se detuvo.";
+    }
+
+    bool reloaded = false;
+
+    try {
+      reloaded = reloadTotals(lands);
+    } catch (SQLite::Exception const &ex) {
+      LOGE("[LM] Failed to read owner totals after the audit: %s") % ex.what();
+    }
+
+    if (!reloaded) LOGW("[LM] Owner totals may be off after the audit until the next restart");
+  }
+
+  if (std::fflush(file) != 0 || std::ferror(file)) return "[Zonas] No se pudo escribir el archivo " + path + ".";
+
+  LOGI("[LM] Audited %d lands, found %d overlapping pairs, sold %d and shrunk %d") % report.lands % report.pairs %
+      report.erased % report.shrunk;
+  return {};
+}
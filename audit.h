@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <optional>
+
+// Whole-world check for lands cutting into each other, which claims made before every overlap was refused can do.
+//
+// A land nested entirely inside a shallower one is a sub-zone and fine, any other two intersecting lands of a
+// dimension are a pair. Pairs are streamed to a CSV file as they are found, one per line:
+//
+//   land_a,land_b,dim,x1,y1,z1,x2,y2,z2
+//
+// where the box is the part the two share. Pairs come out in no particular order. Lines starting with '#' record
+// what a resolution policy did.
+enum class AuditPolicy : int {
+  // Only report
+  Flag,
+
+  // The land claimed first keeps its blocks, every later land cutting into one that is kept is sold
+  Oldest,
+
+  // Later lands give up the blocks they share with earlier ones, cut back along whichever face keeps the most of
+  // them. Lands with nothing left are sold, sub-zones left sticking out are clipped to what is left around them.
+  Shrink,
+};
+
+struct AuditReport {
+  int64_t lands  = 0;
+  int64_t pairs  = 0;
+  int64_t erased = 0;
+  int64_t shrunk = 0;
+};
+
+namespace LandManager {
+// Reads every stored land once the writer has caught up and sweeps them for pairs on threads workers, 0 uses every
+// core. Lands the policy sells or shrinks are changed through the usual mutations.
+std::optional<std::string> AuditLands(const std::string &path, AuditPolicy policy, int threads, AuditReport &report);
+} // namespace LandManager
@@ -4,53 +4,200 @@
 #include <Command/CommandOrigin.h>
 #include <Command/CommandOutput.h>
 #include <Command/CommandRegistry.h>
+#include <Packet/TextPacket.h>
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include <functional>
 
 #include "settings.h"
+#include "session.h"
+#include "transfer.h"
+#include "audit.h"
+#include "listing.h"
 
 DEF_LOGGER("LandManager");
 
-CommandSelector<Player> cmd_player;
+namespace {
+
+// Imports, exports and audits read or rewrite every land, one runs at a time on a thread of its own
+std::thread bulkJob;
+std::atomic<bool> bulkRunning{false};
+
+// Result of the last job until the server tick hands it to whoever asked, 0 for the console
+std::mutex bulkMutex;
+std::optional<std::pair<uint64_t, std::string>> bulkResult;
+
+bool startBulkJob(uint64_t xuid, std::function<std::string()> job) {
+  if (bulkRunning.exchange(true)) return false;
+  if (bulkJob.joinable()) bulkJob.join();
+
+  bulkJob = std::thread([xuid, job = std::move(job)] {
+    std::string text = job();
+
+    {
+      std::lock_guard lock(bulkMutex);
+      bulkResult.emplace(xuid, text);
+    }
+
+    bulkRunning = false;
+  });
+
+  return true;
+}
+
+} // namespace
+
+void reportBulkJob() {
+  std::optional<std::pair<uint64_t, std::string>> result;
+
+  {
+    std::lock_guard lock(bulkMutex);
+    result.swap(bulkResult);
+  }
+
+  if (!result) return;
 
-void reset(bool hard = true) {
-  pointA = Vector3();
-  pointB = Vector3();
-  if (hard) action = Action::None;
+  LOGI("[LM] %s") % result->second;
+
+  auto player = result->first ? Mod::PlayerDatabase::GetInstance().Find(result->first) : std::nullopt;
+  if (!player) return;
+
+  auto packet = TextPacket::createTextPacket<TextPacketType::SystemMessage>(player->name, result->second, "");
+  player->player->sendNetworkPacket(packet);
+}
+
+void joinBulkJob() {
+  if (bulkJob.joinable()) bulkJob.join();
 }
 
 class LandManagerCommand : public Command {
 public:
   Action target_action;
   CommandSelector<Player> target_player;
+  std::string target_file;
+  AuditPolicy target_policy = AuditPolicy::Flag;
+  int target_page   = 1;
+  int target_radius = 0;
 
   LandManagerCommand() {}
 
   void execute(CommandOrigin const &origin, CommandOutput &output) {
-    action     = target_action;
-    cmd_player = target_player;
-    std::ostringstream re;
+    // Stats are read-only, they must not interrupt a selection in progress
+    if (target_action == Action::Stats) {
+      if (origin.getPermissionsLevel() < CommandPermissionLevel::GameMasters) {
+        output.error("[Zonas] No tienes permiso para ver las estadisticas.");
+        return;
+      }
+
+      output.success(statsReport());
+      return;
+    }
+
+    // Bulk transfers work on files next to the server, they are not tied to any player
+    if (target_action == Action::Import || target_action == Action::Export || target_action == Action::Audit) {
+      if (origin.getPermissionsLevel() < CommandPermissionLevel::Admin) {
+        output.error(
+            target_action == Action::Audit ? "[Zonas] No tienes permiso para revisar las zonas."
+                                           : "[Zonas] No tienes permiso para importar o exportar zonas.");
+        return;
+      }
+
+      // Whoever asked is told once the job is done, the console only through the log
+      auto entity    = (Player *) origin.getEntity();
+      auto requester = entity ? LandManager::GetPlayerInstance(entity) : std::nullopt;
+      uint64_t xuid  = requester ? requester->xuid : 0;
+
+      Action action      = target_action;
+      std::string file   = target_file;
+      AuditPolicy policy = target_policy;
+
+      bool started = startBulkJob(xuid, [action, file, policy]() -> std::string {
+        std::ostringstream text;
+
+        if (action == Action::Audit) {
+          AuditReport report;
+          auto err = LandManager::AuditLands(file, policy, 0, report);
+          if (err) return *err;
+
+          text << "[Zonas] Se revisaron " << report.lands << " zonas, " << report.pairs << " pares se superponen.";
+          if (report.erased || report.shrunk) {
+            text << " Se vendieron " << report.erased << " zonas y se recortaron " << report.shrunk << ".";
+          }
+
+          return text.str();
+        }
+
+        TransferReport report;
+        auto err = action == Action::Import ? LandManager::ImportLands(file, report)
+                                            : LandManager::ExportLands(file, report);
+        if (err) return *err;
+
+        text << "[Zonas] " << (action == Action::Import ? "Se importaron " : "Se exportaron ") << report.lands
+             << " zonas.";
+        if (report.skipped) {
+          text << " Se omitieron " << report.skipped << " filas, la primera en la linea " << report.firstSkipped << ".";
+        }
+
+        return text.str();
+      });
+
+      if (!started) {
+        output.error("[Zonas] Ya hay una importacion, exportacion o revision en curso, intenta de nuevo mas tarde.");
+        return;
+      }
+
+      output.success("[Zonas] Trabajando en " + file + ", se te avisara al terminar.");
+      return;
+    }
+
+    // Every other action belongs to a player, selections are kept per player
+    auto player    = (Player *) origin.getEntity();
+    auto pInstance = LandManager::GetPlayerInstance(player);
+
+    if (!pInstance) {
+      output.error("[Zonas] Error al realizar accion. Consulte al administrador.");
+      return;
+    }
+
+    int dim = (int) player->getDimensionId();
+
+    Action action = target_action;
 
     if (action == Action::Create) {
-      reset(false);
+      Session *session = sessions.Open(pInstance->xuid);
+
+      if (!session) {
+        output.error("[Zonas] Hay demasiadas selecciones en curso, intenta de nuevo mas tarde.");
+        return;
+      }
+
+      session->action = Action::Create;
+      session->pointA = Vector3();
+      session->pointB = Vector3();
       output.success("[Zonas] Selecciona el punto inicial o sal con '/land exit'");
     } else if (action == Action::Buy) {
+      Session *session = sessions.Find(pInstance->xuid);
+
       // If we havent selected two points yet, return
-      if (!pointA.init || !pointB.init) {
+      if (!session || !session->pointA.init || !session->pointB.init) {
         output.error("[Zonas] Debes seleccionar dos puntos primero.");
         return;
       }
 
-      // Try to get the player instance and just reuse it
-      auto player    = (Player *) origin.getEntity();
-      auto pInstance = LandManager::GetPlayerInstance(player);
+      Vector3 pointA = session->pointA;
+      Vector3 pointB = session->pointB;
 
-      if (!pInstance) {
-        output.error("[Zonas] Error al realizar accion. Consulte al administrador.");
+      if (pointA.Dim != pointB.Dim) {
+        output.error("[Zonas] Los dos puntos deben estar en la misma dimension.");
         return;
       }
 
       // Check if we have enough money
-      auto balance = Mod::Economy::GetBalance(player);
-      int price    = pointA.Volume(pointB) * settings.blockPrice;
+      auto balance  = Mod::Economy::GetBalance(player);
+      int64_t price = LandPrice(pointA.Volume(pointB));
 
       if (price > balance) {
         output.success("[Zonas] No cuentas con suficiente dinero.");
@@ -94,13 +241,11 @@ public:
 
       output.success("[Zonas] Has comprado la zona.");
 
-      reset();
+      sessions.Close(pInstance->xuid);
     } else if (action == Action::Sell) {
-      auto player    = (Player *) origin.getEntity();
-      auto pInstance = LandManager::GetPlayerInstance(player);
-      Vec3 pos       = origin.getWorldPosition();
+      Vec3 pos = origin.getWorldPosition();
 
-      std::string sold = LandManager::SellLand(*pInstance, Vector3(pos.x, pos.y, pos.z));
+      std::string sold = LandManager::SellLand(*pInstance, Vector3(pos.x, pos.y, pos.z, dim));
 
       output.success(sold);
     } else if (action == Action::Give) {
@@ -113,15 +258,44 @@ public:
         if (it != playerdb.end()) {
           Vec3 pos = origin.getWorldPosition();
 
-          std::string give = LandManager::GiveLand(*it, Vector3(pos.x, pos.y, pos.z));
+          std::string give = LandManager::GiveLand(*pInstance, *it, Vector3(pos.x, pos.y, pos.z, dim));
 
           output.success(give);
         }
       } else {
         output.error("[Zonas] No se encontro el jugador objetivo especificado.");
       }
+    } else if (action == Action::Trust || action == Action::Untrust) {
+      auto &playerdb = Mod::PlayerDatabase::GetInstance().GetData();
+      auto results   = target_player.results(origin);
+
+      if (results.count() > 0) {
+        auto it = playerdb.find(*(results.begin()));
+
+        if (it != playerdb.end()) {
+          Vec3 pos = origin.getWorldPosition();
+
+          std::string trust = action == Action::Trust
+                                  ? LandManager::TrustPlayer(*pInstance, *it, Vector3(pos.x, pos.y, pos.z, dim))
+                                  : LandManager::UntrustPlayer(*pInstance, *it, Vector3(pos.x, pos.y, pos.z, dim));
+
+          output.success(trust);
+        }
+      } else {
+        output.error("[Zonas] No se encontro el jugador objetivo especificado.");
+      }
+    } else if (action == Action::List) {
+      // Without a free session the page is still listed, only skipping from the first land
+      Session *session = sessions.Open(pInstance->xuid);
+      ListCursor cursor;
+
+      output.success(LandManager::ListLands(*pInstance, target_page, session ? session->listed : cursor));
+    } else if (action == Action::Near) {
+      Vec3 pos = origin.getWorldPosition();
+
+      output.success(LandManager::NearLands(Vector3::Block(pos.x, pos.y, pos.z, dim), target_radius));
     } else if (action == Action::Exit) {
-      reset();
+      sessions.Close(pInstance->xuid);
     }
   }
 
@@ -136,6 +310,15 @@ public:
         {{"create", Action::Create}, {"buy", Action::Buy}, {"sell", Action::Sell}, {"exit", Action::Exit}});
 
     addEnum<Action>(registry, "land-option-give", {{"give", Action::Give}});
+    addEnum<Action>(registry, "land-option-trust", {{"trust", Action::Trust}, {"untrust", Action::Untrust}});
+    addEnum<Action>(registry, "land-option-stats", {{"stats", Action::Stats}});
+    addEnum<Action>(registry, "land-option-transfer", {{"import", Action::Import}, {"export", Action::Export}});
+    addEnum<Action>(registry, "land-option-list", {{"list", Action::List}});
+    addEnum<Action>(registry, "land-option-near", {{"near", Action::Near}});
+    addEnum<Action>(registry, "land-option-audit", {{"audit", Action::Audit}});
+    addEnum<AuditPolicy>(
+        registry, "land-audit-policy",
+        {{"flag", AuditPolicy::Flag}, {"oldest", AuditPolicy::Oldest}, {"shrink", AuditPolicy::Shrink}});
 
     registry->registerOverload<LandManagerCommand>(
         "land", mandatory<CommandParameterDataType::ENUM>(&LandManagerCommand::target_action, "action", "land-option"));
@@ -143,6 +326,30 @@ public:
         "land",
         mandatory<CommandParameterDataType::ENUM>(&LandManagerCommand::target_action, "action", "land-option-give"),
         mandatory(&LandManagerCommand::target_player, "target"));
+    registry->registerOverload<LandManagerCommand>(
+        "land",
+        mandatory<CommandParameterDataType::ENUM>(&LandManagerCommand::target_action, "action", "land-option-trust"),
+        mandatory(&LandManagerCommand::target_player, "target"));
+    registry->registerOverload<LandManagerCommand>(
+        "land",
+        mandatory<CommandParameterDataType::ENUM>(&LandManagerCommand::target_action, "action", "land-option-stats"));
+    registry->registerOverload<LandManagerCommand>(
+        "land",
+        mandatory<CommandParameterDataType::ENUM>(&LandManagerCommand::target_action, "action", "land-option-transfer"),
+        mandatory(&LandManagerCommand::target_file, "file"));
+    registry->registerOverload<LandManagerCommand>(
+        "land",
+        mandatory<CommandParameterDataType::ENUM>(&LandManagerCommand::target_action, "action", "land-option-list"),
+        optional(&LandManagerCommand::target_page, "page"));
+    registry->registerOverload<LandManagerCommand>(
+        "land",
+        mandatory<CommandParameterDataType::ENUM>(&LandManagerCommand::target_action, "action", "land-option-near"),
+        optional(&LandManagerCommand::target_radius, "radius"));
+    registry->registerOverload<LandManagerCommand>(
+        "land",
+        mandatory<CommandParameterDataType::ENUM>(&LandManagerCommand::target_action, "action", "land-option-audit"),
+        mandatory(&LandManagerCommand::target_file, "file"),
+        optional<CommandParameterDataType::ENUM>(&LandManagerCommand::target_policy, "policy", "land-audit-policy"));
   }
 };
 
@@ -1,298 +1,396 @@
-#include "settings.h"
+#include <random>
+
+#include "database.h"
+#include "region.h"
+#include "rent.h"
+#include "snapshot.h"
+#include "stats.h"
 
 DEF_LOGGER("LandManager");
 
-using json = nlohmann::json;
+namespace {
+
+// Schema upgrades in order, a database at user_version N runs every step after the Nth. Released steps must never
+// change, append a new one instead.
+const char *migrations[] = {
+    // 1: the original lands table, databases from before versioning already have it
+    "CREATE TABLE IF NOT EXISTS lands "
+    "(owner INTEGER, trusted TEXT, x1 INTEGER, y1 INTEGER, z1 INTEGER, x2 INTEGER, y2 INTEGER, z2 INTEGER, "
+    "chkx1 INTEGER, chky1 INTEGER, chkz1 INTEGER, chkx2 INTEGER, chky2 INTEGER, chkz2 INTEGER, "
+    "created_at DATETIME DEFAULT(STRFTIME('%Y-%m-%d %H:%M:%f', 'now')))",
+
+    // 2: trusted players and writer progress
+    "CREATE TABLE IF NOT EXISTS trusts (land INTEGER, xuid INTEGER, PRIMARY KEY (land, xuid)) WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS meta (key TEXT PRIMARY KEY, value INTEGER)",
+
+    // 3: land ids become a real 64-bit primary key so VACUUM can never renumber them, the JSON trusted column goes
+    "CREATE TABLE lands_v3 "
+    "(id INTEGER PRIMARY KEY, owner INTEGER NOT NULL, x1 INTEGER, y1 INTEGER, z1 INTEGER, x2 INTEGER, y2 INTEGER, "
+    "z2 INTEGER, chkx1 INTEGER, chky1 INTEGER, chkz1 INTEGER, chkx2 INTEGER, chky2 INTEGER, chkz2 INTEGER, "
+    "created_at DATETIME DEFAULT(STRFTIME('%Y-%m-%d %H:%M:%f', 'now')));"
+    "INSERT INTO lands_v3 SELECT rowid, owner, x1, y1, z1, x2, y2, z2, chkx1, chky1, chkz1, chkx2, chky2, chkz2, "
+    "created_at FROM lands;"
+    "DROP TABLE lands;"
+    "ALTER TABLE lands_v3 RENAME TO lands",
+
+    // 4: owner lookups are answered from the index alone, chunk lookups seek on the corner chunks
+    "CREATE INDEX IF NOT EXISTS lands_owner ON lands (owner, x1, y1, z1, x2, y2, z2);"
+    "CREATE INDEX IF NOT EXISTS lands_chunks ON lands (chkx1, chkz1, chkx2, chkz2)",
+
+    // 5: lands belong to a dimension, every land claimed so far was meant for the Overworld
+    "ALTER TABLE lands ADD COLUMN dim INTEGER NOT NULL DEFAULT 0;"
+    "DROP INDEX lands_owner;"
+    "DROP INDEX lands_chunks;"
+    "CREATE INDEX lands_owner ON lands (owner, dim, x1, y1, z1, x2, y2, z2);"
+    "CREATE INDEX lands_chunks ON lands (dim, chkx1, chkz1, chkx2, chkz2)",
+
+    // 6: lands are paged in by tile (32x32 chunks), with a row for every tile a land covers. Lands covering more than
+    // 64 tiles get a single row under the pinned tile. Must agree with RegionCache as of this version.
+    "CREATE TABLE land_tiles "
+    "(dim INTEGER NOT NULL, tx INTEGER NOT NULL, tz INTEGER NOT NULL, id INTEGER NOT NULL, "
+    "PRIMARY KEY (dim, tx, tz, id)) WITHOUT ROWID;"
+    "CREATE INDEX land_tiles_id ON land_tiles (id);"
+    "INSERT INTO land_tiles (dim, tx, tz, id) "
+    "WITH RECURSIVE spans (id, dim, tx1, tz1, tx2, tz2) AS "
+    "(SELECT id, dim, MIN(chkx1, chkx2) >> 5, MIN(chkz1, chkz2) >> 5, MAX(chkx1, chkx2) >> 5, MAX(chkz1, chkz2) >> 5 "
+    "FROM lands), "
+    "columns (id, dim, tx, tz1, tx2, tz2) AS "
+    "(SELECT * FROM spans WHERE (tx2 - tx1 + 1) * (tz2 - tz1 + 1) <= 64 "
+    "UNION ALL SELECT id, dim, tx + 1, tz1, tx2, tz2 FROM columns WHERE tx < tx2), "
+    "tiles (id, dim, tx, tz, tz2) AS "
+    "(SELECT id, dim, tx, tz1, tz2 FROM columns UNION ALL SELECT id, dim, tx, tz + 1, tz2 FROM tiles WHERE tz < tz2) "
+    "SELECT dim, tx, tz, id FROM tiles "
+    "UNION ALL SELECT dim, -2147483648, -2147483648, id FROM spans WHERE (tx2 - tx1 + 1) * (tz2 - tz1 + 1) > 64",
+
+    // 7: the unix time each land is paid up to, 0 until its first rent is collected
+    "ALTER TABLE lands ADD COLUMN paid_until INTEGER NOT NULL DEFAULT 0",
+
+    // 8: how many lands each land is nested in, every land stored so far is top level
+    "ALTER TABLE lands ADD COLUMN depth INTEGER NOT NULL DEFAULT 0",
+
+    // 9: corners are stored lowest first, lands claimed before the index kept them in the order they were clicked
+    "UPDATE lands SET x1 = MIN(x1, x2), y1 = MIN(y1, y2), z1 = MIN(z1, z2), "
+    "x2 = MAX(x1, x2), y2 = MAX(y1, y2), z2 = MAX(z1, z2), "
+    "chkx1 = MIN(chkx1, chkx2), chky1 = MIN(chky1, chky2), chkz1 = MIN(chkz1, chkz2), "
+    "chkx2 = MAX(chkx1, chkx2), chky2 = MAX(chky1, chky2), chkz2 = MAX(chkz1, chkz2) "
+    "WHERE x1 > x2 OR y1 > y2 OR z1 > z2 OR chkx1 > chkx2 OR chky1 > chky2 OR chkz1 > chkz2",
+
+    // 10: the lands of an owner are listed page by page in id order, each page seeks to the id the last one ended at
+    "CREATE INDEX lands_owner_id ON lands (owner, id)",
+};
+
+constexpr int kSchemaVersion = sizeof(migrations) / sizeof(*migrations);
+
+const char *kOwnerTotals =
+    "SELECT owner, COUNT(*), SUM((x2 - x1 + 1) * (y2 - y1 + 1) * (z2 - z1 + 1)) FROM lands GROUP BY owner";
+
+// Opened at startup when it matches the database, page-ins read from it instead of querying
+LandSnapshot snapshot;
+
+// A tile with more changes than this since startup is read from the database, which only replays what the writer
+// has not committed yet
+constexpr size_t kMaxReplay = 256;
+
+void migrate() {
+  SQLite::Statement stmt{*landDB, "PRAGMA user_version"};
+  int version = stmt.executeStep() ? stmt.getColumn(0).getInt() : 0;
+  stmt.reset();
+
+  if (version > kSchemaVersion) {
+    LOGW("[LM] Database schema version %d is newer than this build (%d)") % version % kSchemaVersion;
+    return;
+  }
 
-void LandManager::InitDatabase() {
-  landDB = std::make_unique<SQLite::Database>(settings.database, SQLite::OPEN_CREATE | SQLite::OPEN_READWRITE);
-  landDB->exec(
-      "CREATE TABLE IF NOT EXISTS lands "
-      "(owner INTEGER, trusted TEXT, x1 INTEGER, y1 INTEGER, z1 INTEGER, x2 "
-      "INTEGER, y2 INTEGER, z2 INTEGER, chkx1 "
-      "INTEGER, chky1 INTEGER, "
-      "chkz1 INTEGER, chkx2 INTEGER, chky2 INTEGER, chkz2 INTEGER, created_at "
-      "DATETIME DEFAULT(STRFTIME('%Y-%m-%d %H:%M:%f', 'now')))");
-}
+  // Each step commits together with its version, an interrupted upgrade resumes from the last finished step
+  for (; version < kSchemaVersion; version++) {
+    SQLite::Transaction trans(*landDB);
 
-Vector3 getChunk(Vector3 vec) {
-  int x = vec.X > 0 ? std::floor(vec.X / 16) : std::ceil(vec.X / 16);
-  int y = vec.Y > 0 ? std::floor(vec.Y / 16) : std::ceil(vec.Y / 16);
-  int z = vec.Z > 0 ? std::floor(vec.Z / 16) : std::ceil(vec.Z / 16);
+    landDB->exec(migrations[version]);
+    landDB->exec("PRAGMA user_version = " + std::to_string(version + 1));
 
-  return Vector3(x, y, z);
+    trans.commit();
+    LOGI("[LM] Upgraded database schema to version %d") % (version + 1);
+  }
 }
 
-bool isInside(Vector3 point, Vector3 start, Vector3 end) {
-  Cube c = Cube(start, end);
-
-  return (
-      point.X >= c.xMin() && point.X <= c.xMax() && point.Y >= c.yMin() && point.Y <= c.yMax() && point.Z >= c.zMin() &&
-      point.Z <= c.zMax());
-}
+// Applies mutations in order to the lands stored under a tile
+void replay(const std::vector<LandMutation> &mutations, int dim, int32_t tx, int32_t tz,
+            std::unordered_map<int64_t, PagedLand> &lands) {
+  for (const LandMutation &mutation : mutations) {
+    const LandRecord &land = mutation.land;
+    auto it                = lands.find(land.id);
 
-bool doIntersect(Vector3 new1, Vector3 new2, Vector3 test1, Vector3 test2) {
-  Cube cNew  = Cube(new1, new2);
-  Cube cTest = Cube(test1, test2);
+    if (mutation.kind == LandMutation::Kind::Insert) {
+      if (land.dim == dim && RegionCache::Stored(land.box, tx, tz)) lands[land.id] = PagedLand{land, {}};
+      continue;
+    }
 
-  std::ostringstream ree;
+    if (it == lands.end()) continue;
 
-  ree << cNew.xMin() << "," << cNew.yMin() << "," << cNew.zMin() << " | " << cNew.xMax() << "," << cNew.yMax() << ","
-      << cNew.zMax();
-  LOGW(ree.str().c_str());
+    TrustSet &trusted = it->second.trusted;
 
-  return (cNew.xMin() <= cTest.xMax() && cNew.xMax() >= cTest.xMin()) &&
-         (cNew.yMin() <= cTest.yMax() && cNew.yMax() >= cTest.yMin()) &&
-         (cNew.zMin() <= cTest.zMax() && cNew.zMax() >= cTest.zMin());
+    switch (mutation.kind) {
+    case LandMutation::Kind::Erase: lands.erase(it); break;
+    case LandMutation::Kind::SetOwner: it->second.land.owner = land.owner; break;
+    case LandMutation::Kind::Trust:
+      if (std::find(trusted.begin(), trusted.end(), mutation.player) == trusted.end()) {
+        trusted.push_back(mutation.player);
+      }
+      break;
+    case LandMutation::Kind::Untrust:
+      trusted.erase(std::remove(trusted.begin(), trusted.end(), mutation.player), trusted.end());
+      break;
+    case LandMutation::Kind::Resize:
+      if (RegionCache::Stored(land.box, tx, tz)) {
+        it->second.land.box = land.box;
+      } else {
+        lands.erase(it);
+      }
+      break;
+    default: break;
+    }
+  }
 }
 
-std::vector<uint16_t> findStandingLand(Mod::PlayerEntry player, Vector3 block) {
+// Reads every land stored under a tile, then replays on top whatever the writer has not committed yet. The table
+// may already hold some of those changes, applying one twice gives the same result.
+//
+// While the startup snapshot is open the tile is copied out of it instead, with the changes made to its lands since
+// startup replayed.
+void pageTile(int dim, int32_t tx, int32_t tz, std::vector<PagedLand> &out) {
   static SQLite::Statement stmt{
-      *landDB,
-      "SELECT rowid, x1, y1, z1, x2, y2, z2 FROM lands WHERE owner = ? AND ((chkx1 = ? AND chky1 = ? AND chkz1 = "
-      "?) OR (chkx2 = ? AND chky2 = ? AND chkz2 = ?))"};
+      *landDB, "SELECT l.id, l.owner, l.x1, l.y1, l.z1, l.x2, l.y2, l.z2, l.depth, t.xuid FROM land_tiles r "
+               "JOIN lands l ON l.id = r.id LEFT JOIN trusts t ON t.land = r.id "
+               "WHERE r.dim = ? AND r.tx = ? AND r.tz = ?"};
+
+  std::unordered_map<int64_t, PagedLand> lands;
+  std::vector<LandMutation> changes;
+
+  if (snapshot.IsOpen()) {
+    std::vector<PagedLand> stored;
+    std::vector<int64_t> ids;
+    snapshot.Tile(dim, tx, tz, stored);
+
+    ids.reserve(stored.size());
+    for (const PagedLand &page : stored) ids.push_back(page.land.id);
+
+    if (!LandManager::RecordedMutations(dim, tx, tz, ids, kMaxReplay, changes)) {
+      LOGI("[LM] Too many land changes since startup, reading regions from the database again");
+      snapshot.Close();
+    } else if (changes.size() <= kMaxReplay) {
+      for (PagedLand &page : stored) lands[page.land.id] = std::move(page);
+      replay(changes, dim, tx, tz, lands);
+
+      for (auto &[id, page] : lands) out.push_back(std::move(page));
+      return;
+    }
+  }
 
   BOOST_SCOPE_EXIT_ALL() {
     stmt.clearBindings();
     stmt.tryReset();
   };
 
-  std::vector<uint16_t> ids;
-  Vector3 chunk = getChunk(block);
+  // Taken before reading, so a change committed in between is in both and none is missed
+  changes = LandManager::PendingMutations();
 
-  try {
-    stmt.bind(1, (int64_t) player.xuid);
-    stmt.bind(2, chunk.X);
-    stmt.bind(3, chunk.Y);
-    stmt.bind(4, chunk.Z);
-    stmt.bind(5, chunk.X);
-    stmt.bind(6, chunk.Y);
-    stmt.bind(7, chunk.Z);
+  stmt.bind(1, dim);
+  stmt.bind(2, tx);
+  stmt.bind(3, tz);
 
-    while (stmt.executeStep()) {
-      uint16_t rowid = stmt.getColumn(0).getInt64();
-      int x1         = stmt.getColumn(1).getInt();
-      int y1         = stmt.getColumn(2).getInt();
-      int z1         = stmt.getColumn(3).getInt();
-      int x2         = stmt.getColumn(4).getInt();
-      int y2         = stmt.getColumn(5).getInt();
-      int z2         = stmt.getColumn(6).getInt();
+  while (stmt.executeStep()) {
+    PagedLand &page = lands[stmt.getColumn(0).getInt64()];
 
-      bool inside = isInside(block, Vector3(x1, y1, z1), Vector3(x2, y2, z2));
-
-      if (inside) { ids.push_back(rowid); }
+    if (page.land.id == 0) {
+      page.land.id    = stmt.getColumn(0).getInt64();
+      page.land.owner = stmt.getColumn(1).getInt64();
+      page.land.dim   = dim;
+      page.land.box   = LandBox(
+          stmt.getColumn(2).getInt(), stmt.getColumn(3).getInt(), stmt.getColumn(4).getInt(),
+          stmt.getColumn(5).getInt(), stmt.getColumn(6).getInt(), stmt.getColumn(7).getInt());
+      page.land.depth = stmt.getColumn(8).getInt();
     }
-  } catch (SQLite::Exception ex) {
-    LOGE(ex.what());
-    return ids;
+
+    if (!stmt.getColumn(9).isNull()) page.trusted.push_back(stmt.getColumn(9).getInt64());
   }
 
-  return ids;
+  replay(changes, dim, tx, tz, lands);
+
+  for (auto &[id, page] : lands) out.push_back(std::move(page));
 }
 
-std::optional<Mod::PlayerEntry> LandManager::GetPlayerInstance(Player *player) {
-  auto &pdb     = Mod::PlayerDatabase::GetInstance();
-  auto instance = pdb.Find(player);
+} // namespace
 
-  if (instance) { return instance; }
+void LandManager::InitDatabase() {
+  ScopedTimer timer(landStats[Probe::InitDatabase]);
 
-  return {};
-}
+  landDB = std::make_unique<SQLite::Database>(settings.database, SQLite::OPEN_CREATE | SQLite::OPEN_READWRITE);
 
-std::optional<std::string> LandManager::ReachedLimit(Mod::PlayerEntry player) {
-  static SQLite::Statement stmt{*landDB, "SELECT COUNT(*) FROM lands WHERE owner = ?"};
+  // The writer thread batches commits and WAL keeps them from blocking readers. Each batch must be on disk when it
+  // commits, the land journal can drop it right after.
+  landDB->exec("PRAGMA journal_mode = WAL");
+  landDB->exec("PRAGMA synchronous = FULL");
+  landDB->exec("PRAGMA cache_size = -16384");
 
-  BOOST_SCOPE_EXIT_ALL() {
-    stmt.clearBindings();
-    stmt.reset();
-  };
+  migrate();
 
-  stmt.bind(1, (int64_t) player.xuid);
+  LandManager::RecoverJournal();
 
-  try {
-    int count = stmt.executeStep() ? stmt.getColumn(0).getInt() : 0;
-    if (count >= settings.limit) return "[Zonas] Haz alcanzado el limite de zonas.";
-  } catch (SQLite::Exception ex) { return "[Zonas] Ocurrio un error. Contacte al administrador."; }
+  // Only the per-owner totals are read up front, lands are paged in by region the first time a lookup reaches them
+  std::vector<std::pair<uint64_t, OwnerTotals>> owners;
 
-  return {};
-}
+  SQLite::Statement token{*landDB, "SELECT value FROM meta WHERE key = 'snapshot'"};
+  int64_t expected = token.executeStep() ? token.getColumn(0).getInt64() : 0;
 
-std::optional<std::string> LandManager::Overlaps(Mod::PlayerEntry player, Vector3 start, Vector3 end) {
-  // We get all the zones in the same chunks and check for overlapping
+  if (expected && snapshot.Open(settings.snapshot, kSchemaVersion, expected)) {
+    snapshot.ForEachOwner([&](const LandSnapshot::Owner &owner) {
+      OwnerTotals totals;
+      totals.lands  = (int) owner.lands;
+      totals.volume = owner.volume;
 
-  static SQLite::Statement stmt{
-      *landDB,
-      "SELECT x1, y1, z1, x2, y2, z2 FROM lands WHERE (chkx1 = ? AND chky1 = ? AND chkz1 = ?) OR (chkx2 = ? AND chky2 "
-      "= ? AND chkz2 = ?) OR (chkx1 = ? AND chky1 = ? AND chkz1 = ?) OR (chkx2 = ? AND chky2 = ? AND chkz2 = ?)"};
+      owners.emplace_back(owner.owner, totals);
+    });
 
-  BOOST_SCOPE_EXIT_ALL() {
-    stmt.clearBindings();
-    stmt.tryReset();
-  };
+    LandManager::StartRecording();
+    LOGI("[LM] Loaded land snapshot for %d owners") % owners.size();
+  } else {
+    if (expected) LOGW("[LM] Land snapshot is missing or damaged, reading from the database");
 
-  Vector3 chunk1 = getChunk(start);
-  Vector3 chunk2 = getChunk(end);
-
-  stmt.bind(1, chunk1.X);
-  stmt.bind(2, chunk1.Y);
-  stmt.bind(3, chunk1.Z);
-  stmt.bind(4, chunk1.X);
-  stmt.bind(5, chunk1.Y);
-  stmt.bind(6, chunk1.Z);
-  stmt.bind(7, chunk2.X);
-  stmt.bind(8, chunk2.Y);
-  stmt.bind(9, chunk2.Z);
-  stmt.bind(10, chunk2.X);
-  stmt.bind(11, chunk2.Y);
-  stmt.bind(12, chunk2.Z);
+    SQLite::Statement stmt{*landDB, kOwnerTotals};
 
-  try {
     while (stmt.executeStep()) {
-      int x1 = stmt.getColumn(0).getInt();
-      int y1 = stmt.getColumn(1).getInt();
-      int z1 = stmt.getColumn(2).getInt();
-      int x2 = stmt.getColumn(3).getInt();
-      int y2 = stmt.getColumn(4).getInt();
-      int z2 = stmt.getColumn(5).getInt();
-
-      bool inters = doIntersect(start, end, Vector3(x1, y1, z1), Vector3(x2, y2, z2));
-      if (inters) return "[Zonas] Estas encima de una zona ya existente.";
+      OwnerTotals totals;
+      totals.lands  = stmt.getColumn(1).getInt();
+      totals.volume = stmt.getColumn(2).getInt64();
+
+      owners.emplace_back(stmt.getColumn(0).getInt64(), totals);
     }
-  } catch (SQLite::Exception ex) { return "[Zonas] Ocurrio un error. Contacte al administrador."; }
+  }
 
-  return {};
-}
+  landIndex.Write([&](LandIndex &index) {
+    index.Clear();
+    for (auto &[owner, totals] : owners) index.SetTotals(owner, totals);
+  });
 
-bool LandManager::HasPerm(Mod::PlayerEntry player, Vector3 block) {
-  // We get all the zones in the block's chunk and check for perms
+  regions.Start(pageTile, (int64_t) settings.memoryBudget << 20);
+  rents.Load();
 
-  static SQLite::Statement stmt{
-      *landDB,
-      "SELECT owner, x1, y1, z1, x2, y2, z2 FROM lands WHERE (chkx1 = ? AND chky1 = ? AND chkz1 = ?) OR (chkx2 = ? "
-      "AND chky2 = ? AND chkz2 = ?)"};
+  if (settings.verifyTotals) LandManager::VerifyTotals();
 
-  BOOST_SCOPE_EXIT_ALL() {
-    stmt.clearBindings();
-    stmt.tryReset();
-  };
+  LandManager::StartWriter();
+}
 
-  Vector3 chunk = getChunk(block);
+// Writes every stored land to the snapshot file and ties it to the current database state, only valid once the
+// writer has stopped with everything committed
+void LandManager::SaveSnapshot() {
+  // The pager may still be reading the mapped file, and renaming over it is not allowed everywhere
+  regions.Stop();
+  snapshot.Close();
 
-  stmt.bind(1, chunk.X);
-  stmt.bind(2, chunk.Y);
-  stmt.bind(3, chunk.Z);
-  stmt.bind(4, chunk.X);
-  stmt.bind(5, chunk.Y);
-  stmt.bind(6, chunk.Z);
+  LandSnapshot::Data data;
 
   try {
-    while (stmt.executeStep()) {
-      uint64_t owner = stmt.getColumn(0).getInt64();
-      int x1         = stmt.getColumn(1).getInt();
-      int y1         = stmt.getColumn(2).getInt();
-      int z1         = stmt.getColumn(3).getInt();
-      int x2         = stmt.getColumn(4).getInt();
-      int y2         = stmt.getColumn(5).getInt();
-      int z2         = stmt.getColumn(6).getInt();
-
-      bool inside = isInside(block, Vector3(x1, y1, z1), Vector3(x2, y2, z2));
-
-      if (inside && owner != player.xuid) {
-        // For now we only check if its the player, we should add actual perms later
-        return false;
-      }
-    }
-  } catch (SQLite::Exception ex) {
-    LOGE(ex.what());
-    return false;
-  }
+    SQLite::Statement owners{*landDB, kOwnerTotals};
 
-  return true;
-}
+    while (owners.executeStep()) {
+      data.owners.push_back(LandSnapshot::Owner{
+          (uint64_t) owners.getColumn(0).getInt64(), owners.getColumn(2).getInt64(), owners.getColumn(1).getInt64()});
+    }
 
-std::optional<std::string> LandManager::BuyLand(Mod::PlayerEntry player, Vector3 start, Vector3 end) {
-  // We store the player, start, end and their corresponding chunks
+    // Trusted players are stored once per land, every tile entry of the land points at the same range
+    std::unordered_map<int64_t, std::pair<uint32_t, uint32_t>> ranges;
+    SQLite::Statement trusts{*landDB, "SELECT land, xuid FROM trusts ORDER BY land, xuid"};
 
-  static SQLite::Statement stmt{
-      *landDB,
-      "INSERT INTO lands (owner, trusted, x1, y1, z1, x2, y2, z2, chkx1, chky1, chkz1, chkx2, chky2, chkz2) VALUES "
-      "(?, "
-      "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"};
+    while (trusts.executeStep()) {
+      auto [it, added] = ranges.try_emplace(trusts.getColumn(0).getInt64(), (uint32_t) data.trusts.size(), 0);
+      it->second.second++;
+      data.trusts.push_back(trusts.getColumn(1).getInt64());
+    }
 
-  BOOST_SCOPE_EXIT_ALL() {
-    stmt.clearBindings();
-    stmt.tryReset();
-  };
+    SQLite::Statement tiles{
+        *landDB, "SELECT r.dim, r.tx, r.tz, l.id, l.owner, l.x1, l.y1, l.z1, l.x2, l.y2, l.z2, l.depth "
+                 "FROM land_tiles r JOIN lands l ON l.id = r.id ORDER BY r.dim, r.tx, r.tz, r.id"};
 
-  std::string trusted = json::array({}).dump();
-  Vector3 chunk1      = getChunk(start);
-  Vector3 chunk2      = getChunk(end);
-
-  stmt.bind(1, (int64_t) player.xuid);
-  stmt.bindNoCopy(2, trusted);
-  stmt.bind(3, start.X);
-  stmt.bind(4, start.Y);
-  stmt.bind(5, start.Z);
-  stmt.bind(6, end.X);
-  stmt.bind(7, end.Y);
-  stmt.bind(8, end.Z);
-  stmt.bind(9, chunk1.X);
-  stmt.bind(10, chunk1.Y);
-  stmt.bind(11, chunk1.Z);
-  stmt.bind(12, chunk2.X);
-  stmt.bind(13, chunk2.Y);
-  stmt.bind(14, chunk2.Z);
+    while (tiles.executeStep()) {
+      int32_t dim = tiles.getColumn(0).getInt();
+      int32_t tx  = tiles.getColumn(1).getInt();
+      int32_t tz  = tiles.getColumn(2).getInt();
 
-  try {
-    stmt.exec();
-    return {};
-  } catch (SQLite::Exception const &ex) { return ex.what(); }
-}
+      if (data.tiles.empty() || data.tiles.back().dim != dim || data.tiles.back().x != tx ||
+          data.tiles.back().z != tz) {
+        data.tiles.push_back(LandSnapshot::TileEntry{dim, tx, tz, 0, data.lands.size()});
+      }
 
-std::string LandManager::SellLand(Mod::PlayerEntry player, Vector3 block) {
-  std::vector<uint16_t> ids = findStandingLand(player, block);
+      LandSnapshot::Land land{};
+      land.id    = tiles.getColumn(3).getInt64();
+      land.owner = tiles.getColumn(4).getInt64();
+      for (int i = 0; i < 6; i++) land.box[i] = tiles.getColumn(5 + i).getInt();
+      land.depth = tiles.getColumn(11).getInt();
 
-  for (uint16_t id : ids) {
-    static SQLite::Statement stmt{*landDB, "DELETE FROM lands WHERE rowid = ?"};
+      auto range = ranges.find(land.id);
+      if (range != ranges.end()) std::tie(land.trustFirst, land.trustCount) = range->second;
 
-    BOOST_SCOPE_EXIT_ALL() {
-      stmt.clearBindings();
-      stmt.tryReset();
-    };
+      data.lands.push_back(land);
+      data.tiles.back().count++;
+    }
+  } catch (SQLite::Exception const &ex) {
+    LOGE("[LM] Failed to read lands for the snapshot: %s") % ex.what();
+    return;
+  }
 
-    stmt.bind(1, id);
+  std::random_device random;
+  int64_t token = 0;
+  while (!token) token = (int64_t) ((uint64_t) random() << 32 | random());
 
-    try {
-      stmt.exec();
-      return "[Zonas] Has vendido una zona.";
-    } catch (SQLite::Exception const &ex) { return "[Zonas] Ocurrio un error. Contacte al administrador."; }
+  if (!LandSnapshot::Write(settings.snapshot, kSchemaVersion, token, data)) {
+    LOGE("[LM] Failed to write the land snapshot");
+    return;
   }
 
-  return "[Zonas] No estas dentro de una zona.";
+  SQLite::Statement stmt{*landDB, "INSERT OR REPLACE INTO meta (key, value) VALUES ('snapshot', ?)"};
+  stmt.bind(1, token);
+  stmt.exec();
+
+  LOGI("[LM] Saved land snapshot with %d lands") % data.lands.size();
 }
 
-std::string LandManager::GiveLand(Mod::PlayerEntry player, Vector3 block) {
-  std::vector<uint16_t> ids = findStandingLand(player, block);
+// Compares the per-owner totals kept by the index with a full aggregate over the table, only valid while the writer
+// is idle
+bool LandManager::VerifyTotals() {
+  SQLite::Statement stmt{*landDB, kOwnerTotals};
 
-  for (uint16_t id : ids) {
-    static SQLite::Statement stmt{*landDB, "UPDATE lands SET owner = ? WHERE rowid = ?"};
+  auto index    = landIndex.Read();
+  size_t owners = 0;
+  bool valid    = true;
 
-    BOOST_SCOPE_EXIT_ALL() {
-      stmt.clearBindings();
-      stmt.tryReset();
-    };
+  while (stmt.executeStep()) {
+    uint64_t owner     = stmt.getColumn(0).getInt64();
+    OwnerTotals totals = index->Totals(owner);
+    int lands          = stmt.getColumn(1).getInt();
+    int64_t volume     = stmt.getColumn(2).getInt64();
 
-    stmt.bind(1, (int64_t) player.xuid);
-    stmt.bind(2, id);
+    owners++;
 
-    try {
-      stmt.exec();
-      return "[Zonas] Has transferido una zona.";
-    } catch (SQLite::Exception const &ex) { return "[Zonas] Ocurrio un error. Contacte al administrador."; }
+    if (totals.lands != lands || totals.volume != volume) {
+      LOGE("[LM] Totals for owner %llu are off: index has %d lands, %lld blocks, database has %d lands, %lld blocks") %
+          (unsigned long long) owner % totals.lands % (long long) totals.volume % lands % (long long) volume;
+      valid = false;
+    }
   }
 
-  return "[Zonas] No estas dentro de una zona.";
+  if (index->Owners() != owners) {
+    LOGE("[LM] Index tracks %d owners, database has %d") % index->Owners() % owners;
+    valid = false;
+  }
+
+  if (valid) LOGI("[LM] Owner totals verified for %d owners") % owners;
+  return valid;
 }
 
-LandManager::Transaction::Transaction() : trans(*landDB) {}
-void LandManager::Transaction::Commit() { trans.commit(); }
+Vector3 getChunk(Vector3 vec) {
+  int x = vec.X > 0 ? std::floor(vec.X / 16) : std::ceil(vec.X / 16);
+  int y = vec.Y > 0 ? std::floor(vec.Y / 16) : std::ceil(vec.Y / 16);
+  int z = vec.Z > 0 ? std::floor(vec.Z / 16) : std::ceil(vec.Z / 16);
+
+  return Vector3(x, y, z);
+}
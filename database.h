@@ -0,0 +1,10 @@
+#pragma once
+
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <boost/scope_exit.hpp>
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "settings.h"
+
+extern std::unique_ptr<SQLite::Database> landDB;
@@ -0,0 +1,425 @@
+#include <sstream>
+
+#include "settings.h"
+#include "session.h"
+#include "landmanager.h"
+#include "region.h"
+#include "stats.h"
+
+// The deepest land the player owns around the block, commands act on the most specific one
+std::vector<int64_t> findStandingLand(Mod::PlayerEntry player, Vector3 block) {
+  ScopedTimer timer(landStats[Probe::FindStanding]);
+  std::vector<int64_t> ids;
+  int32_t deepest = -1;
+
+  auto index = regions.Read(block.Dim, block.X, block.Y, block.Z);
+  index->Visit(block.Dim, block.X, block.Y, block.Z, [&](const LandRecord &land) {
+    if (land.owner == player.xuid && land.depth > deepest) {
+      deepest = land.depth;
+      ids.assign(1, land.id);
+    }
+    return true;
+  });
+
+  return ids;
+}
+
+// Deepest land holding the whole box, the one a land bought there is nested in
+static std::optional<LandRecord> enclosingLand(int dim, const LandBox &box) {
+  std::optional<LandRecord> parent;
+
+  regions.Read(dim, box.X1, box.Y1, box.Z1)->Visit(dim, box.X1, box.Y1, box.Z1, [&](const LandRecord &land) {
+    if (land.box.Contains(box) && (!parent || land.depth > parent->depth)) parent = land;
+    return true;
+  });
+
+  // The trust set belongs to the copy we read from
+  if (parent) parent->trusted = nullptr;
+  return parent;
+}
+
+std::optional<Mod::PlayerEntry> LandManager::GetPlayerInstance(Player *player) {
+  auto &pdb     = Mod::PlayerDatabase::GetInstance();
+  auto instance = pdb.Find(player);
+
+  if (instance) { return instance; }
+
+  return {};
+}
+
+std::optional<std::string> LandManager::ReachedLimit(Mod::PlayerEntry player) {
+  ScopedTimer timer(landStats[Probe::ReachedLimit]);
+
+  // The index keeps a running count per owner, the database may still be behind the writer queue
+  if (landIndex.Read()->Totals(player.xuid).lands >= settings.limit) {
+    landStats[Probe::ReachedLimit].Deny();
+    return "[Zonas] Haz alcanzado el limite de zonas.";
+  }
+
+  return {};
+}
+
+std::vector<LandRecord> LandManager::Conflicts(Vector3 start, Vector3 end) {
+  ScopedTimer timer(landStats[Probe::Conflicts]);
+  std::vector<LandRecord> conflicts;
+  LandBox box = Cube(start, end).Box();
+
+  regions.Read(start.Dim, box)->Overlapping(start.Dim, box, [&](const LandRecord &land) {
+    // A land holding the whole selection is not in the way, the new land would be nested in it
+    if (land.box.Contains(box)) return true;
+
+    conflicts.push_back(land);
+    // The trust set belongs to the copy we read from, it is gone once the reader is released
+    conflicts.back().trusted = nullptr;
+    return true;
+  });
+
+  return conflicts;
+}
+
+std::optional<std::string> LandManager::Overlaps(Mod::PlayerEntry player, Vector3 start, Vector3 end) {
+  ScopedTimer timer(landStats[Probe::Overlaps]);
+
+  // Every land cutting into the selection is a conflict, not only the ones sharing its corner chunks
+  std::vector<LandRecord> conflicts = Conflicts(start, end);
+  if (!conflicts.empty()) landStats[Probe::Overlaps].Deny();
+
+  if (conflicts.size() == 1) return "[Zonas] Estas encima de una zona ya existente.";
+  if (conflicts.size() > 1) {
+    std::ostringstream text;
+    text << "[Zonas] Estas encima de " << conflicts.size() << " zonas ya existentes.";
+    return text.str();
+  }
+
+  // Inside other lands the selection becomes a sub-zone of the deepest one, only its owner may divide it
+  std::optional<LandRecord> parent = enclosingLand(start.Dim, Cube(start, end).Box());
+  if (!parent) return {};
+
+  if (parent->owner != player.xuid) {
+    landStats[Probe::Overlaps].Deny();
+    return "[Zonas] Solo el dueno de la zona puede crear subzonas dentro de ella.";
+  }
+
+  if (parent->depth >= LandIndex::kMaxDepth) {
+    landStats[Probe::Overlaps].Deny();
+    return "[Zonas] No puedes crear mas subzonas dentro de esta zona.";
+  }
+
+  return {};
+}
+
+bool LandManager::HasPerm(Mod::PlayerEntry player, Vector3 block) {
+  ScopedTimer timer(landStats[Probe::HasPerm]);
+
+  // We check the lands containing the block straight from the resident index, the deepest one decides
+  DeepestLand deepest;
+
+  auto index = regions.Read(block.Dim, block.X, block.Y, block.Z);
+  index->Visit(block.Dim, block.X, block.Y, block.Z, [&](const LandRecord &land) {
+    // Owners and trusted players can build, trust is a sorted list so this stays a binary search
+    deepest.Add(land, player.xuid);
+    return true;
+  });
+
+  if (!deepest.allowed) landStats[Probe::HasPerm].Deny();
+  return deepest.allowed;
+}
+
+// HasPerm for the event hooks, server thread only since it goes through the session table
+bool LandManager::CheckPerm(Mod::PlayerEntry player, Vector3 block) {
+  CachedDecision &cached    = sessions.Decision(player.xuid);
+  LandIndex::Decision &perm = cached.perm;
+
+  bool reuse = cached.xuid == player.xuid && perm.dim == block.Dim && perm.region.Contains(block.X, block.Y, block.Z);
+
+  if (reuse && landIndex.Read()->Unchanged(perm)) {
+    landStats.cacheHits.fetch_add(1, std::memory_order_relaxed);
+    if (!perm.allowed) landStats[Probe::HasPerm].Deny();
+    return perm.allowed;
+  }
+
+  landStats.cacheMisses.fetch_add(1, std::memory_order_relaxed);
+  ScopedTimer timer(landStats[Probe::HasPerm]);
+
+  // A column can straddle two tiles, the answer only holds inside the one that was paged in
+  auto index  = regions.Read(block.Dim, block.X, block.Y, block.Z);
+  int32_t tx  = RegionCache::Tile(block.X);
+  int32_t tz  = RegionCache::Tile(block.Z);
+  perm        = index->Decide(block.Dim, block.X, block.Y, block.Z, player.xuid);
+  perm.region = perm.region.Clip(RegionCache::Bounds(tx, tz));
+  cached.xuid = player.xuid;
+
+  if (!perm.allowed) landStats[Probe::HasPerm].Deny();
+  return perm.allowed;
+}
+
+std::optional<std::string> LandManager::BuyLand(Mod::PlayerEntry player, Vector3 start, Vector3 end) {
+  ScopedTimer timer(landStats[Probe::BuyLand]);
+
+  // The land is visible right away, the writer thread stores it with its chunks later
+
+  LandMutation mutation;
+  mutation.kind       = LandMutation::Kind::Insert;
+  mutation.land.id    = NextLandId();
+  mutation.land.owner = player.xuid;
+  mutation.land.dim   = start.Dim;
+  mutation.land.box   = Cube(start, end).Box();
+
+  std::optional<LandRecord> parent = enclosingLand(start.Dim, mutation.land.box);
+  if (parent) mutation.land.depth = parent->depth + 1;
+
+  Submit(mutation);
+  return {};
+}
+
+std::string LandManager::SellLand(Mod::PlayerEntry player, Vector3 block) {
+  ScopedTimer timer(landStats[Probe::SellLand]);
+  std::vector<int64_t> ids = findStandingLand(player, block);
+
+  // Sub-zones stay with their owners. They still lie inside whatever held the sold land, and nothing can be bought
+  // around them, so they answer to the next land out without being renumbered.
+  for (int64_t id : ids) {
+    LandMutation mutation;
+    mutation.kind    = LandMutation::Kind::Erase;
+    mutation.land.id = id;
+
+    Submit(mutation);
+    return "[Zonas] Has vendido una zona.";
+  }
+
+  return "[Zonas] No estas dentro de una zona.";
+}
+
+std::string LandManager::GiveLand(Mod::PlayerEntry player, Mod::PlayerEntry target, Vector3 block) {
+  ScopedTimer timer(landStats[Probe::GiveLand]);
+  std::vector<int64_t> ids = findStandingLand(player, block);
+
+  for (int64_t id : ids) {
+    if (target.xuid == player.xuid) return "[Zonas] Ya eres el dueno de esta zona.";
+
+    // The land counts against the receiver's limit from now on
+    if (landIndex.Read()->Totals(target.xuid).lands >= settings.limit) {
+      landStats[Probe::GiveLand].Deny();
+      return "[Zonas] " + target.name + " alcanzo el limite de zonas.";
+    }
+
+    LandMutation mutation;
+    mutation.kind       = LandMutation::Kind::SetOwner;
+    mutation.land.id    = id;
+    mutation.land.owner = target.xuid;
+
+    Submit(mutation);
+    return "[Zonas] Has transferido una zona.";
+  }
+
+  return "[Zonas] No estas dentro de una zona.";
+}
+
+// Only players on the trust list, not the owner
+static bool isTrusted(int64_t id, uint64_t xuid) {
+  auto index = landIndex.Read();
+  auto land  = index->Find(id);
+
+  return land && land->owner != xuid && land->Allows(xuid);
+}
+
+std::string LandManager::TrustPlayer(Mod::PlayerEntry player, Mod::PlayerEntry target, Vector3 block) {
+  std::vector<int64_t> ids = findStandingLand(player, block);
+
+  for (int64_t id : ids) {
+    if (target.xuid == player.xuid || isTrusted(id, target.xuid))
+      return "[Zonas] " + target.name + " ya tiene permiso en esta zona.";
+
+    LandMutation mutation;
+    mutation.kind    = LandMutation::Kind::Trust;
+    mutation.land.id = id;
+    mutation.player  = target.xuid;
+
+    Submit(mutation);
+    return "[Zonas] " + target.name + " ahora puede construir en esta zona.";
+  }
+
+  return "[Zonas] No estas dentro de una zona.";
+}
+
+std::string LandManager::UntrustPlayer(Mod::PlayerEntry player, Mod::PlayerEntry target, Vector3 block) {
+  std::vector<int64_t> ids = findStandingLand(player, block);
+
+  for (int64_t id : ids) {
+    if (!isTrusted(id, target.xuid)) return "[Zonas] " + target.name + " no tiene permiso en esta zona.";
+
+    LandMutation mutation;
+    mutation.kind    = LandMutation::Kind::Untrust;
+    mutation.land.id = id;
+    mutation.player  = target.xuid;
+
+    Submit(mutation);
+    return "[Zonas] " + target.name + " ya no puede construir en esta zona.";
+  }
+
+  return "[Zonas] No estas dentro de una zona.";
+}
+
+namespace {
+
+struct Overlap {
+  LandBox box;
+  int32_t depth;
+  bool allowed;
+};
+
+// Every land in the way that denies the player, minus the lands nested in it which decide for themselves. Lands
+// either nest or stay apart, so the parts never overlap. With first set it stops at the first part found.
+void deniedParts(uint64_t xuid, int dim, const LandBox &box, bool first, std::vector<LandBox> &denied) {
+  std::vector<Overlap> lands;
+  bool any = false;
+
+  regions.Read(dim, box)->Overlapping(dim, box, [&](const LandRecord &land) {
+    lands.push_back({land.box, land.depth, land.Allows(xuid)});
+    any |= !lands.back().allowed;
+    return true;
+  });
+
+  if (!any) return;
+
+  std::vector<LandBox> parts, next;
+
+  for (const Overlap &land : lands) {
+    if (land.allowed) continue;
+
+    parts.assign(1, land.box.Clip(box));
+
+    for (const Overlap &inner : lands) {
+      if (inner.depth <= land.depth || !land.box.Contains(inner.box)) continue;
+
+      next.clear();
+      for (const LandBox &part : parts) part.Subtract(inner.box, [&](const LandBox &piece) { next.push_back(piece); });
+      parts.swap(next);
+    }
+
+    denied.insert(denied.end(), parts.begin(), parts.end());
+    if (first && !denied.empty()) return;
+  }
+}
+
+} // namespace
+
+bool LandManager::MayModify(uint64_t xuid, int dim, const LandBox &box) {
+  std::vector<LandBox> denied;
+  deniedParts(xuid, dim, box, true, denied);
+
+  return denied.empty();
+}
+
+std::vector<LandBox> LandManager::DeniedRegions(uint64_t xuid, int dim, const LandBox &box) {
+  ScopedTimer timer(landStats[Probe::DeniedRegions]);
+  std::vector<LandBox> denied;
+
+  deniedParts(xuid, dim, box, false, denied);
+
+  if (!denied.empty()) landStats[Probe::DeniedRegions].Deny();
+  return denied;
+}
+
+namespace {
+
+// Blocks whose bounds hold more than this many blocks per block asked about are spread out, one walk over the bounds
+// would load and scan everything between them. They are checked one 16x16 column at a time instead.
+constexpr int64_t kSparseVolume = 4096;
+
+LandBox boundsOf(const std::vector<LandBlock> &blocks, const uint32_t *group, size_t count) {
+  const LandBlock &first = blocks[group[0]];
+  LandBox bounds(first.X, first.Y, first.Z, first.X, first.Y, first.Z);
+
+  for (size_t i = 1; i < count; i++) {
+    const LandBlock &block = blocks[group[i]];
+    bounds.X1              = std::min(bounds.X1, block.X);
+    bounds.Y1              = std::min(bounds.Y1, block.Y);
+    bounds.Z1              = std::min(bounds.Z1, block.Z);
+    bounds.X2              = std::max(bounds.X2, block.X);
+    bounds.Y2              = std::max(bounds.Y2, block.Y);
+    bounds.Z2              = std::max(bounds.Z2, block.Z);
+  }
+
+  return bounds;
+}
+
+// Clears the bits of the blocks among group that lie in a part of a land denying the player, false if none could
+bool denyBlocks(
+    uint64_t xuid, int dim, const std::vector<LandBlock> &blocks, const uint32_t *group, size_t count,
+    std::vector<uint64_t> &allowed) {
+  LandBox bounds = boundsOf(blocks, group, count);
+
+  std::vector<LandBox> denied;
+  deniedParts(xuid, dim, bounds, false, denied);
+  if (denied.empty()) return false;
+
+  // The denied regions become SIMD planes, so a block is tested against up to kBlock of them per call
+  size_t stride = (denied.size() + LandSimd::kPad - 1) / LandSimd::kPad * LandSimd::kPad;
+  std::vector<int32_t> planes(6 * stride);
+
+  for (size_t plane = 0; plane < 6; plane++) {
+    std::fill_n(planes.begin() + plane * stride, stride, plane < 3 ? LandSimd::kEmptyMin : LandSimd::kEmptyMax);
+  }
+
+  for (size_t i = 0; i < denied.size(); i++) {
+    planes[i]              = denied[i].X1;
+    planes[stride + i]     = denied[i].Y1;
+    planes[2 * stride + i] = denied[i].Z1;
+    planes[3 * stride + i] = denied[i].X2;
+    planes[4 * stride + i] = denied[i].Y2;
+    planes[5 * stride + i] = denied[i].Z2;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const LandBlock &block = blocks[group[i]];
+
+    for (size_t base = 0; base < stride; base += LandSimd::kBlock) {
+      size_t end = std::min(base + LandSimd::kBlock, stride);
+
+      if (LandSimd::MaskPoint(planes.data(), stride, base, end, block.X, block.Y, block.Z)) {
+        allowed[group[i] / 64] &= ~(1ull << (group[i] % 64));
+        break;
+      }
+    }
+  }
+
+  return true;
+}
+
+inline uint64_t columnOf(const LandBlock &block) {
+  return (uint64_t) (uint32_t) (block.X >> LandIndex::kCellShift) << 32 | (uint32_t) (block.Z >> LandIndex::kCellShift);
+}
+
+} // namespace
+
+std::vector<uint64_t> LandManager::AllowedBlocks(uint64_t xuid, int dim, const std::vector<LandBlock> &blocks) {
+  ScopedTimer timer(landStats[Probe::AllowedBlocks]);
+  std::vector<uint64_t> allowed((blocks.size() + 63) / 64, ~0ull);
+
+  if (blocks.empty()) return allowed;
+  if (blocks.size() % 64) allowed.back() = (1ull << (blocks.size() % 64)) - 1;
+
+  std::vector<uint32_t> order(blocks.size());
+  for (size_t i = 0; i < blocks.size(); i++) order[i] = (uint32_t) i;
+
+  // Blocks packed together, like a blast, share one index walk over their bounds
+  bool denied = false;
+
+  if (boundsOf(blocks, order.data(), order.size()).Volume() / (int64_t) blocks.size() <= kSparseVolume) {
+    denied = denyBlocks(xuid, dim, blocks, order.data(), order.size(), allowed);
+  } else {
+    auto byColumn = [&](uint32_t a, uint32_t b) { return columnOf(blocks[a]) < columnOf(blocks[b]); };
+    std::sort(order.begin(), order.end(), byColumn);
+
+    for (size_t begin = 0, end; begin < order.size(); begin = end) {
+      uint64_t column = columnOf(blocks[order[begin]]);
+      for (end = begin + 1; end < order.size() && columnOf(blocks[order[end]]) == column; end++) {}
+
+      denied = denyBlocks(xuid, dim, blocks, order.data() + begin, end - begin, allowed) || denied;
+    }
+  }
+
+  if (denied) landStats[Probe::AllowedBlocks].Deny();
+  return allowed;
+}
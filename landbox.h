@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+
+// Normalized land bounds, the min corner is always X1/Y1/Z1 and the max corner X2/Y2/Z2
+struct LandBox {
+  int X1 = 0, Y1 = 0, Z1 = 0;
+  int X2 = 0, Y2 = 0, Z2 = 0;
+
+  inline LandBox(void) {}
+  inline LandBox(const int x1, const int y1, const int z1, const int x2, const int y2, const int z2) {
+    X1 = x1 < x2 ? x1 : x2;
+    Y1 = y1 < y2 ? y1 : y2;
+    Z1 = z1 < z2 ? z1 : z2;
+    X2 = x1 < x2 ? x2 : x1;
+    Y2 = y1 < y2 ? y2 : y1;
+    Z2 = z1 < z2 ? z2 : z1;
+  }
+
+  inline bool Contains(const int x, const int y, const int z) const {
+    return x >= X1 && x <= X2 && y >= Y1 && y <= Y2 && z >= Z1 && z <= Z2;
+  }
+
+  // True if every block of A is inside the box
+  inline bool Contains(const LandBox &A) const {
+    return A.X1 >= X1 && A.X2 <= X2 && A.Y1 >= Y1 && A.Y2 <= Y2 && A.Z1 >= Z1 && A.Z2 <= Z2;
+  }
+
+  inline bool Intersects(const LandBox &A) const {
+    return X1 <= A.X2 && X2 >= A.X1 && Y1 <= A.Y2 && Y2 >= A.Y1 && Z1 <= A.Z2 && Z2 >= A.Z1;
+  }
+
+  // The part shared with A, only meaningful when they intersect
+  inline LandBox Clip(const LandBox &A) const {
+    LandBox box;
+    box.X1 = X1 > A.X1 ? X1 : A.X1;
+    box.Y1 = Y1 > A.Y1 ? Y1 : A.Y1;
+    box.Z1 = Z1 > A.Z1 ? Z1 : A.Z1;
+    box.X2 = X2 < A.X2 ? X2 : A.X2;
+    box.Y2 = Y2 < A.Y2 ? Y2 : A.Y2;
+    box.Z2 = Z2 < A.Z2 ? Z2 : A.Z2;
+    return box;
+  }
+
+  // Calls f with what is left of the box once A is cut out of it, up to six boxes that do not overlap
+  template <typename F> inline void Subtract(const LandBox &A, F f) const {
+    if (!Intersects(A)) {
+      f(*this);
+      return;
+    }
+
+    LandBox rest = *this;
+    LandBox piece;
+
+    if (rest.X1 < A.X1) {
+      piece    = rest;
+      piece.X2 = A.X1 - 1;
+      rest.X1  = A.X1;
+      f(piece);
+    }
+
+    if (rest.X2 > A.X2) {
+      piece    = rest;
+      piece.X1 = A.X2 + 1;
+      rest.X2  = A.X2;
+      f(piece);
+    }
+
+    if (rest.Y1 < A.Y1) {
+      piece    = rest;
+      piece.Y2 = A.Y1 - 1;
+      rest.Y1  = A.Y1;
+      f(piece);
+    }
+
+    if (rest.Y2 > A.Y2) {
+      piece    = rest;
+      piece.Y1 = A.Y2 + 1;
+      rest.Y2  = A.Y2;
+      f(piece);
+    }
+
+    if (rest.Z1 < A.Z1) {
+      piece    = rest;
+      piece.Z2 = A.Z1 - 1;
+      rest.Z1  = A.Z1;
+      f(piece);
+    }
+
+    if (rest.Z2 > A.Z2) {
+      piece    = rest;
+      piece.Z1 = A.Z2 + 1;
+      f(piece);
+    }
+  }
+
+  inline bool operator==(const LandBox &A) const {
+    return X1 == A.X1 && Y1 == A.Y1 && Z1 == A.Z1 && X2 == A.X2 && Y2 == A.Y2 && Z2 == A.Z2;
+  }
+
+  // Squared distance from a block to the closest block of the box, 0 inside it
+  inline int64_t DistanceSquared(const int x, const int y, const int z) const {
+    int64_t dx = x < X1 ? (int64_t) X1 - x : x > X2 ? (int64_t) x - X2 : 0;
+    int64_t dy = y < Y1 ? (int64_t) Y1 - y : y > Y2 ? (int64_t) y - Y2 : 0;
+    int64_t dz = z < Z1 ? (int64_t) Z1 - z : z > Z2 ? (int64_t) z - Z2 : 0;
+    return dx * dx + dy * dy + dz * dz;
+  }
+
+  // Blocks covered, both corners included
+  inline int64_t Volume() const {
+    return ((int64_t) X2 - X1 + 1) * ((int64_t) Y2 - Y1 + 1) * ((int64_t) Z2 - Z1 + 1);
+  }
+};
@@ -0,0 +1,615 @@
+#include "landindex.h"
+
+#include <algorithm>
+
+int64_t LandIndex::cellCount(const LandBox &box) {
+  int64_t width = (int64_t) (box.X2 >> kCellShift) - (box.X1 >> kCellShift) + 1;
+  int64_t depth = (int64_t) (box.Z2 >> kCellShift) - (box.Z1 >> kCellShift) + 1;
+
+  return width * depth;
+}
+
+LandIndex::LandIndex() { trustSets.emplace_back(); }
+
+void LandIndex::Cell::put(size_t i, const LandBox &box) {
+  planes[i]              = box.X1;
+  planes[stride + i]     = box.Y1;
+  planes[2 * stride + i] = box.Z1;
+  planes[3 * stride + i] = box.X2;
+  planes[4 * stride + i] = box.Y2;
+  planes[5 * stride + i] = box.Z2;
+}
+
+void LandIndex::Cell::Push(uint32_t slot, const std::vector<PackedLand> &packed) {
+  slots.push_back(slot);
+  if (stride == 0 && Size() < kScalarLands) return;
+
+  // Grow every plane at once and refill them from the packed lands, new positions hold bounds that never match
+  if (Size() > stride) {
+    stride = stride ? stride * 2 : 2 * kScalarLands;
+    planes.assign(6 * stride, 0);
+
+    for (size_t plane = 0; plane < 6; plane++) {
+      int32_t empty = plane < 3 ? LandSimd::kEmptyMin : LandSimd::kEmptyMax;
+      std::fill(planes.begin() + plane * stride, planes.begin() + (plane + 1) * stride, empty);
+    }
+
+    for (size_t i = 0; i < Size(); i++) put(i, packed[slots[i]].box);
+    return;
+  }
+
+  put(Size() - 1, packed[slot].box);
+}
+
+void LandIndex::Cell::Remove(uint32_t slot) {
+  auto it = std::find(slots.begin(), slots.end(), slot);
+  if (it == slots.end()) return;
+
+  // Move the last land into the hole and blank its old position
+  size_t i    = it - slots.begin();
+  size_t last = Size() - 1;
+
+  for (size_t plane = 0; stride && plane < 6; plane++) {
+    planes[plane * stride + i]    = planes[plane * stride + last];
+    planes[plane * stride + last] = plane < 3 ? LandSimd::kEmptyMin : LandSimd::kEmptyMax;
+  }
+
+  slots[i] = slots[last];
+  slots.pop_back();
+}
+
+// Doubles once the table would be more than 3/4 full, spilled cells keep their indices
+void LandIndex::ColumnTable::grow() {
+  std::vector<Column> old = std::move(entries);
+  entries.assign(old.empty() ? 16 : old.size() * 2, Column{kFree, 0, {}});
+
+  size_t mask = entries.size() - 1;
+
+  for (const Column &column : old) {
+    if (column.key == kFree) continue;
+
+    size_t i = hash(column.key) & mask;
+    while (entries[i].key != kFree) i = (i + 1) & mask;
+    entries[i] = column;
+  }
+}
+
+void LandIndex::ColumnTable::Push(uint64_t key, uint32_t slot, const std::vector<PackedLand> &packed) {
+  if ((size + 1) * 4 > entries.size() * 3) grow();
+
+  size_t mask = entries.size() - 1;
+  size_t i    = hash(key) & mask;
+
+  while (entries[i].key != kFree && entries[i].key != key) i = (i + 1) & mask;
+
+  Column &column = entries[i];
+
+  if (column.key == kFree) {
+    column.key   = key;
+    column.count = 0;
+    size++;
+  }
+
+  if (column.count < Column::kInline) {
+    column.slots[column.count++] = slot;
+    return;
+  }
+
+  if (column.count == Column::kInline) {
+    uint32_t at;
+
+    if (freeSpilled.empty()) {
+      at = (uint32_t) spilled.size();
+      spilled.emplace_back();
+    } else {
+      at = freeSpilled.back();
+      freeSpilled.pop_back();
+    }
+
+    for (uint32_t inlined : column.slots) spilled[at].Push(inlined, packed);
+    column.slots[0] = at;
+  }
+
+  spilled[column.slots[0]].Push(slot, packed);
+  column.count++;
+}
+
+// Entries after an emptied column move back into it unless that would put them before their home position
+void LandIndex::ColumnTable::Remove(uint64_t key, uint32_t slot) {
+  if (entries.empty()) return;
+
+  size_t mask = entries.size() - 1;
+  size_t hole = hash(key) & mask;
+
+  while (entries[hole].key != key) {
+    if (entries[hole].key == kFree) return;
+    hole = (hole + 1) & mask;
+  }
+
+  Column &column = entries[hole];
+
+  if (column.count > Column::kInline) {
+    uint32_t at = column.slots[0];
+    Cell &cell  = spilled[at];
+    size_t had  = cell.Size();
+
+    cell.Remove(slot);
+    if (cell.Size() == had) return;
+
+    // Back to fitting in the entry, the cell's buffers are freed
+    if (--column.count == Column::kInline) {
+      std::copy_n(cell.slots.begin(), Column::kInline, column.slots);
+      spilled[at] = Cell();
+      freeSpilled.push_back(at);
+    }
+
+    return;
+  }
+
+  uint32_t *end = column.slots + column.count;
+  uint32_t *pos = std::find(column.slots, end, slot);
+  if (pos == end) return;
+
+  *pos = *(end - 1);
+  if (--column.count > 0) return;
+
+  for (size_t i = (hole + 1) & mask; entries[i].key != kFree; i = (i + 1) & mask) {
+    size_t home = hash(entries[i].key) & mask;
+
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      entries[hole] = entries[i];
+      hole          = i;
+    }
+  }
+
+  entries[hole].key = kFree;
+  size--;
+}
+
+void LandIndex::ColumnTable::Clear() {
+  entries.clear();
+  spilled.clear();
+  freeSpilled.clear();
+  size = 0;
+}
+
+uint32_t LandIndex::internOwner(uint64_t xuid) {
+  auto [it, added] = ownerSlots.try_emplace(xuid, 0);
+
+  if (added) {
+    if (freeOwners.empty()) {
+      it->second = (uint32_t) ownerXuids.size();
+      ownerXuids.push_back(xuid);
+      ownerRefs.push_back(0);
+    } else {
+      it->second = freeOwners.back();
+      freeOwners.pop_back();
+      ownerXuids[it->second] = xuid;
+    }
+  }
+
+  ownerRefs[it->second]++;
+  return it->second;
+}
+
+void LandIndex::releaseOwner(uint32_t owner) {
+  if (--ownerRefs[owner] > 0) return;
+
+  ownerSlots.erase(ownerXuids[owner]);
+  freeOwners.push_back(owner);
+}
+
+uint32_t LandIndex::allocateTrust() {
+  if (freeTrusts.empty()) {
+    trustSets.emplace_back();
+    return (uint32_t) trustSets.size() - 1;
+  }
+
+  uint32_t trust = freeTrusts.back();
+  freeTrusts.pop_back();
+  return trust;
+}
+
+void LandIndex::releaseTrust(uint32_t trust) {
+  if (trust == 0) return;
+
+  trustSets[trust] = TrustSet();
+  freeTrusts.push_back(trust);
+}
+
+uint32_t LandIndex::slotOf(int64_t id) const {
+  if (table.empty()) return kNone;
+
+  size_t mask = table.size() - 1;
+
+  for (size_t i = hashId(id) & mask;; i = (i + 1) & mask) {
+    if (table[i] == kNone || ids[table[i]] == id) return table[i];
+  }
+}
+
+// The slot's id must be set, the table is kept at most 3/4 full
+void LandIndex::link(uint32_t slot) {
+  if ((live + 1) * 4 > table.size() * 3) {
+    std::vector<uint32_t> old = std::move(table);
+    table.assign(old.empty() ? 64 : old.size() * 2, kNone);
+
+    for (uint32_t moved : old) {
+      if (moved != kNone) link(moved);
+    }
+  }
+
+  size_t mask = table.size() - 1;
+  size_t i    = hashId(ids[slot]) & mask;
+
+  while (table[i] != kNone) i = (i + 1) & mask;
+  table[i] = slot;
+}
+
+// Entries after the hole move back into it unless that would put them before their home position
+void LandIndex::unlink(uint32_t slot) {
+  size_t mask = table.size() - 1;
+  size_t hole = hashId(ids[slot]) & mask;
+
+  while (table[hole] != slot) hole = (hole + 1) & mask;
+
+  for (size_t i = (hole + 1) & mask; table[i] != kNone; i = (i + 1) & mask) {
+    size_t home = hashId(ids[table[i]]) & mask;
+
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      table[hole] = table[i];
+      hole        = i;
+    }
+  }
+
+  table[hole] = kNone;
+}
+
+void LandIndex::account(uint64_t owner, const LandBox &box, int sign) {
+  OwnerTotals &totals = owners[owner];
+  totals.lands += sign;
+  totals.volume += sign * box.Volume();
+
+  if (totals.lands == 0) owners.erase(owner);
+}
+
+void LandIndex::touch(int dim, const LandBox &box) {
+  if (isOversize(box)) {
+    global++;
+    return;
+  }
+
+  forEachCell(box, [&](uint64_t key) { generations[generationSlot(dim, key)]++; });
+}
+
+// Counters keep going instead of being reset, a decision taken before the clear must not match again later
+void LandIndex::Clear() {
+  global++;
+  changes++;
+  cleared = changes;
+  packed.clear();
+  ids.clear();
+  nodes.clear();
+  table.clear();
+  largeNodes.clear();
+  freeSlot = kNone;
+  live     = 0;
+
+  ownerXuids.clear();
+  ownerRefs.clear();
+  freeOwners.clear();
+  ownerSlots.clear();
+
+  trustSets.assign(1, TrustSet());
+  freeTrusts.clear();
+
+  owners.clear();
+  held.clear();
+  bytes = 0;
+
+  for (Partition &part : partitions) {
+    part.cells.Clear();
+    part.tree.Clear();
+    part.large.Clear();
+  }
+}
+
+// Heap cost of a land: its slot with the id table entries behind it, a leaf and on average one inner tree node, and
+// every column it was copied into. Claims rarely share columns, so each is counted as a whole column entry in a
+// table between 3/8 and 3/4 full.
+size_t LandIndex::footprint(const LandBox &box) {
+  constexpr size_t kSlot  = sizeof(PackedLand) + sizeof(int64_t) + sizeof(int32_t) + 2 * sizeof(uint32_t);
+  constexpr size_t kNode  = 44;
+  constexpr size_t kEntry = 2 * sizeof(Column);
+
+  if (isOversize(box)) return kSlot + 4 * kNode;
+  return kSlot + 2 * kNode + (size_t) cellCount(box) * kEntry;
+}
+
+void LandIndex::Insert(const LandRecord &land) { insert(land, true); }
+
+bool LandIndex::Erase(int64_t id) { return erase(id, true); }
+
+void LandIndex::Page(const LandRecord &land, const TrustSet &trusted) {
+  if (!insert(land, false) || trusted.empty()) return;
+
+  PackedLand &packedLand = packed[slotOf(land.id)];
+  packedLand.trust       = allocateTrust();
+
+  TrustSet &set = trustSets[packedLand.trust];
+  set           = trusted;
+  std::sort(set.begin(), set.end());
+}
+
+bool LandIndex::Evict(int64_t id) { return erase(id, false); }
+
+void LandIndex::SetTotals(uint64_t owner, const OwnerTotals &totals) {
+  if (totals.lands > 0) {
+    owners[owner] = totals;
+  } else {
+    owners.erase(owner);
+  }
+}
+
+// Lands in a dimension without a partition are left out, nothing could ever look them up
+bool LandIndex::insert(const LandRecord &land, bool counted) {
+  if (slotOf(land.id) != kNone) erase(land.id, counted);
+
+  Partition *part = partition(land.dim);
+  if (!part) return false;
+
+  uint32_t slot = freeSlot;
+
+  if (slot == kNone) {
+    slot = (uint32_t) packed.size();
+    packed.emplace_back();
+    ids.push_back(0);
+    nodes.push_back(AabbTree::kNull);
+  } else {
+    freeSlot = packed[slot].owner;
+  }
+
+  PackedLand &packedLand = packed[slot];
+  packedLand.box         = land.box;
+  packedLand.owner       = internOwner(land.owner);
+  packedLand.trust       = 0;
+  packedLand.flags       = (uint32_t) land.dim | kLive | (uint32_t) land.depth << kDepthShift;
+
+  ids[slot]   = land.id;
+  nodes[slot] = part->tree.Insert(land.box, slot);
+  link(slot);
+  live++;
+
+  if (counted) account(land.owner, land.box, 1);
+  touch(land.dim, land.box);
+  bytes += footprint(land.box);
+
+  if (isOversize(land.box)) {
+    packedLand.flags |= kLarge;
+    largeNodes[slot] = part->large.Insert(land.box, slot);
+  } else {
+    forEachCell(land.box, [&](uint64_t key) { part->cells.Push(key, slot, packed); });
+  }
+
+  return true;
+}
+
+bool LandIndex::erase(int64_t id, bool counted) {
+  uint32_t slot = slotOf(id);
+  if (slot == kNone) return false;
+
+  PackedLand &land  = packed[slot];
+  const int dim     = (int) (land.flags & 0xFF);
+  const LandBox box = land.box;
+  Partition &part   = partitions[dim];
+
+  if (counted) account(ownerXuids[land.owner], box, -1);
+  touch(dim, box);
+  bytes -= footprint(box);
+
+  part.tree.Remove(nodes[slot]);
+
+  if (land.flags & kLarge) {
+    part.large.Remove(largeNodes[slot]);
+    largeNodes.erase(slot);
+  } else {
+    forEachCell(box, [&](uint64_t key) { part.cells.Remove(key, slot); });
+  }
+
+  releaseOwner(land.owner);
+  releaseTrust(land.trust);
+  unlink(slot);
+  live--;
+
+  land.flags = 0;
+  land.trust = 0;
+  land.owner = freeSlot;
+  freeSlot   = slot;
+  return true;
+}
+
+// Cells only hold slots, the owner is changed in one place
+bool LandIndex::SetOwner(int64_t id, uint64_t owner) {
+  uint32_t slot = slotOf(id);
+  if (slot == kNone) return false;
+
+  PackedLand &land = packed[slot];
+  account(ownerXuids[land.owner], land.box, -1);
+  account(owner, land.box, 1);
+  touch((int) (land.flags & 0xFF), land.box);
+
+  uint32_t interned = internOwner(owner);
+  releaseOwner(land.owner);
+  land.owner = interned;
+
+  return true;
+}
+
+bool LandIndex::Trust(int64_t id, uint64_t xuid) {
+  uint32_t slot = slotOf(id);
+  if (slot == kNone) return false;
+
+  PackedLand &land = packed[slot];
+  if (land.trust == 0) land.trust = allocateTrust();
+
+  TrustSet &trusted = trustSets[land.trust];
+  auto pos          = std::lower_bound(trusted.begin(), trusted.end(), xuid);
+
+  if (pos != trusted.end() && *pos == xuid) return false;
+
+  trusted.insert(pos, xuid);
+  touch((int) (land.flags & 0xFF), land.box);
+  return true;
+}
+
+bool LandIndex::Untrust(int64_t id, uint64_t xuid) {
+  uint32_t slot = slotOf(id);
+  if (slot == kNone) return false;
+
+  PackedLand &land = packed[slot];
+  if (land.trust == 0) return false;
+
+  TrustSet &trusted = trustSets[land.trust];
+  auto pos          = std::lower_bound(trusted.begin(), trusted.end(), xuid);
+
+  if (pos == trusted.end() || *pos != xuid) return false;
+
+  trusted.erase(pos);
+  touch((int) (land.flags & 0xFF), land.box);
+
+  if (trusted.empty()) {
+    releaseTrust(land.trust);
+    land.trust = 0;
+  }
+
+  return true;
+}
+
+// Stored again under the same id, the owner's totals follow the new volume and the trusted players are kept
+bool LandIndex::Resize(int64_t id, const LandBox &box) {
+  uint32_t slot = slotOf(id);
+  if (slot == kNone) return false;
+
+  LandRecord land  = record(slot);
+  TrustSet trusted = land.trusted ? *land.trusted : TrustSet();
+  land.box         = box;
+  land.trusted     = nullptr;
+
+  if (!insert(land, true) || trusted.empty()) return true;
+
+  PackedLand &packedLand      = packed[slotOf(id)];
+  packedLand.trust            = allocateTrust();
+  trustSets[packedLand.trust] = std::move(trusted);
+  return true;
+}
+
+void LandIndex::Apply(const LandMutation &mutation) {
+  if (mutation.kind != LandMutation::Kind::Renew) {
+    if (recent.empty()) recent.resize(kRecentChanges);
+    recent[++changes % kRecentChanges] = mutation;
+  }
+
+  switch (mutation.kind) {
+  case LandMutation::Kind::Insert: Insert(mutation.land); break;
+  case LandMutation::Kind::Erase: Erase(mutation.land.id); break;
+  case LandMutation::Kind::SetOwner: SetOwner(mutation.land.id, mutation.land.owner); break;
+  case LandMutation::Kind::Trust: Trust(mutation.land.id, mutation.player); break;
+  case LandMutation::Kind::Untrust: Untrust(mutation.land.id, mutation.player); break;
+  case LandMutation::Kind::Renew: break;
+  case LandMutation::Kind::Resize: Resize(mutation.land.id, mutation.land.box); break;
+  }
+}
+
+bool LandIndex::ChangesSince(uint64_t since, std::vector<LandMutation> &out) const {
+  out.clear();
+  if (since < cleared || changes - since > kRecentChanges) return false;
+
+  for (uint64_t at = since + 1; at <= changes; at++) out.push_back(recent[at % kRecentChanges]);
+  return true;
+}
+
+std::optional<LandRecord> LandIndex::Find(int64_t id) const {
+  uint32_t slot = slotOf(id);
+  if (slot == kNone) return {};
+
+  return record(slot);
+}
+
+OwnerTotals LandIndex::Totals(uint64_t owner) const {
+  auto it = owners.find(owner);
+  return it == owners.end() ? OwnerTotals() : it->second;
+}
+
+LandIndex::Decision LandIndex::Decide(int dim, int x, int y, int z, uint64_t xuid) const {
+  int cx       = x >> kCellShift;
+  int cz       = z >> kCellShift;
+  uint64_t key = cellKey(cx, cz);
+
+  Decision decision;
+  decision.dim        = dim;
+  decision.slot       = generationSlot(dim, key);
+  decision.generation = generations[decision.slot];
+  decision.global     = global;
+  decision.region     = LandBox(
+      cx * (1 << kCellShift), INT32_MIN, cz * (1 << kCellShift), cx * (1 << kCellShift) + (1 << kCellShift) - 1,
+      INT32_MAX, cz * (1 << kCellShift) + (1 << kCellShift) - 1);
+
+  LandBox &region = decision.region;
+  DeepestLand deepest;
+
+  // Lands holding the block shrink the region to fit inside them, the others are cut away along whichever face
+  // keeps the most of it. Shrinking never brings back a land cut earlier, so one pass is enough. The lands holding
+  // the block are nested in each other, so the deepest one seen in that pass decides.
+  auto narrow = [&](const LandRecord &land) {
+    const LandBox &box = land.box;
+
+    if (box.Contains(x, y, z)) {
+      deepest.Add(land, xuid);
+      decision.allowed = deepest.allowed;
+
+      region = region.Clip(box);
+      return;
+    }
+
+    if (!box.Intersects(region)) return;
+
+    // The block is outside the land, so at least one of its faces separates them
+    LandBox cuts[6]  = {region, region, region, region, region, region};
+    bool separate[6] = {x < box.X1, x > box.X2, y < box.Y1, y > box.Y2, z < box.Z1, z > box.Z2};
+
+    cuts[0].X2 = box.X1 - 1;
+    cuts[1].X1 = box.X2 + 1;
+    cuts[2].Y2 = box.Y1 - 1;
+    cuts[3].Y1 = box.Y2 + 1;
+    cuts[4].Z2 = box.Z1 - 1;
+    cuts[5].Z1 = box.Z2 + 1;
+
+    LandBox best;
+    int64_t bestVolume = -1;
+
+    for (int i = 0; i < 6; i++) {
+      if (separate[i] && cuts[i].Volume() > bestVolume) {
+        best       = cuts[i];
+        bestVolume = cuts[i].Volume();
+      }
+    }
+
+    region = best;
+  };
+
+  const Partition *part = partition(dim);
+  if (!part) return decision;
+
+  const LandBox column = region;
+
+  if (const Column *cell = part->cells.Find(key)) {
+    const uint32_t *slots = part->cells.Slots(*cell);
+    for (uint32_t i = 0; i < cell->count; i++) narrow(record(slots[i]));
+  }
+
+  part->large.Query(column, [&](uint32_t slot, const LandBox &) {
+    narrow(record(slot));
+    return true;
+  });
+
+  return decision;
+}
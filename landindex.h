@@ -0,0 +1,450 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "landbox.h"
+#include "aabbtree.h"
+#include "landsimd.h"
+
+// Sorted xuids of the players trusted on a land
+using TrustSet = std::vector<uint64_t>;
+
+struct LandRecord {
+  int64_t id     = 0;
+  uint64_t owner = 0;
+  int32_t dim    = 0;
+  LandBox box;
+
+  // Number of lands this one is nested in, 0 for a top level land. Lands only nest fully inside each other, so the
+  // lands holding a block form a chain and the deepest of them decides for it.
+  int32_t depth = 0;
+
+  // Points into the index, only set on records handed out by lookups
+  const TrustSet *trusted = nullptr;
+
+  inline bool Allows(uint64_t xuid) const {
+    if (owner == xuid) return true;
+    return trusted && !trusted->empty() && std::binary_search(trusted->begin(), trusted->end(), xuid);
+  }
+};
+
+// Answer of the deepest land seen so far holding a block, the lands holding it can be fed in any order
+struct DeepestLand {
+  int32_t depth = -1;
+  bool allowed  = true;
+
+  // Lands at the same depth do not overlap, should two ever hold the same block either one denying is enough
+  inline void Add(const LandRecord &land, uint64_t xuid) {
+    if (land.depth > depth) {
+      depth   = land.depth;
+      allowed = land.Allows(xuid);
+    } else if (land.depth == depth && !land.Allows(xuid)) {
+      allowed = false;
+    }
+  }
+};
+
+// What an owner holds, kept up to date by every mutation
+struct OwnerTotals {
+  int lands      = 0;
+  int64_t volume = 0;
+};
+
+struct LandMutation {
+  enum class Kind : uint32_t { Insert, Erase, SetOwner, Trust, Untrust, Renew, Resize };
+
+  // Resize carries the new box, which lies inside the old one, and leaves everything else about the land as it was
+  Kind kind = Kind::Insert;
+  LandRecord land;
+  uint64_t player   = 0; // Trust and Untrust: the player trusted or no longer trusted on the land
+  int64_t paidUntil = 0; // Renew: the unix time the land is now paid up to
+};
+
+// Resident copy of the lands table, lookups never touch SQLite.
+//
+// Every dimension is a separate partition with its own columns and trees, a lookup only searches the one it is in.
+// Lands are rasterised into 16x16 block columns (the x/z footprint of a chunk), so a point lookup is one hash probe
+// plus a batched SIMD scan of the lands sharing that column. Lands covering more than kMaxCells columns are kept
+// aside in their own tree instead of being copied into thousands of cells. Every land is also in a box tree so large
+// overlap queries find interior hits no matter how many chunks a land spans, small ones scan the columns they cover.
+//
+// Lands themselves are packed into one array and referred to everywhere else by their 32-bit slot in it, which stays
+// the same while the land is resident. Owners are interned and trust sets kept aside, so the packed record is 36 bytes
+// and freed slots are reused before the array grows. That is not what a land costs as a whole: with its id, table
+// entry and tree nodes it is about 150 bytes, and every column it is copied into adds about 50 more: columns live in a
+// flat open-addressing table and keep up to Column::kInline slots without allocating. Claims of 4 to 32 blocks a side
+// average 4 columns, which comes to about 350 bytes per land, see the memory line of tools/bench.cpp (331 MB
+// estimated and 334 MB measured per million). The slot and tree nodes alone keep it well above the 36-byte record.
+// Paging under settings.memoryBudget is what bounds the total.
+class LandIndex {
+public:
+  static constexpr int kCellShift  = 4;
+  static constexpr int kMaxCells   = 256;
+  static constexpr int kDimensions = 3;
+
+  // Deepest a land may be nested
+  static constexpr int32_t kMaxDepth = 15;
+
+  // Overlap queries covering up to this many columns scan the cells instead of walking the tree
+  static constexpr int kMaxQueryCells = 16;
+
+  // Columns share this many change counters, a collision only costs a spurious cache miss
+  static constexpr int kGenerationBits = 12;
+
+  // A permission answer and the box around the block it holds for, while the counters it was read at are unchanged
+  struct Decision {
+    bool allowed = true;
+    int32_t dim  = 0;
+    LandBox region;
+    uint32_t slot       = 0;
+    uint32_t generation = 0;
+    uint32_t global     = 0;
+  };
+
+  LandIndex();
+
+  // Far too large to copy by accident
+  LandIndex(const LandIndex &) = delete;
+  LandIndex &operator=(const LandIndex &) = delete;
+
+  void Clear();
+  void Insert(const LandRecord &land);
+  bool Erase(int64_t id);
+  bool SetOwner(int64_t id, uint64_t owner);
+  bool Trust(int64_t id, uint64_t xuid);
+  bool Untrust(int64_t id, uint64_t xuid);
+  bool Resize(int64_t id, const LandBox &box);
+  void Apply(const LandMutation &mutation);
+
+  // Loading a stored land and dropping it again change what is resident, not what anyone owns, so they leave the
+  // totals alone. Those come from SetTotals when every land is not resident at once.
+  void Page(const LandRecord &land, const TrustSet &trusted);
+  bool Evict(int64_t id);
+  void SetTotals(uint64_t owner, const OwnerTotals &totals);
+
+  // Region cache tiles this copy holds every land of, set in the same write that pages them in or evicts them so a
+  // reader never sees the mark without the lands
+  inline bool Holds(uint64_t tile) const { return held.count(tile) != 0; }
+  inline void Hold(uint64_t tile, bool holds) { holds ? (void) held.insert(tile) : (void) held.erase(tile); }
+
+  std::optional<LandRecord> Find(int64_t id) const;
+  inline size_t Size() const { return live; }
+
+  // Heap use of the resident lands, close to what the allocator actually hands out
+  inline size_t Bytes() const { return bytes; }
+
+  OwnerTotals Totals(uint64_t owner) const;
+  inline size_t Owners() const { return owners.size(); }
+
+  // Same answer as the deepest land containing the block, plus the largest box found inside the block's column
+  // that no land cuts into, so every block in it gets the same answer
+  Decision Decide(int dim, int x, int y, int z, uint64_t xuid) const;
+
+  inline bool Unchanged(const Decision &decision) const {
+    return generations[decision.slot] == decision.generation && global == decision.global;
+  }
+
+  // Bumped by every mutation applied and every clear. Paging leaves it alone, it changes what is resident and not what
+  // is stored, so lands read earlier are still current while it stays the same.
+  inline uint64_t Changes() const { return changes; }
+
+  // The last mutations applied are kept, a page-in that read its lands while they were applied replays the ones it
+  // missed instead of reading them again
+  static constexpr size_t kRecentChanges = 256;
+
+  // Adds to out every mutation applied since Changes() returned since, oldest first. False if some of them are no
+  // longer kept or the index was cleared in between.
+  bool ChangesSince(uint64_t since, std::vector<LandMutation> &out) const;
+
+  template <typename F> void ForEach(F f) const {
+    for (uint32_t slot = 0; slot < packed.size(); slot++) {
+      if (packed[slot].flags & kLive) f(record(slot));
+    }
+  }
+
+  // Calls f for every land containing the block, stops as soon as f returns false
+  template <typename F> void Visit(const int dim, const int x, const int y, const int z, F f) const {
+    const Partition *part = partition(dim);
+    if (!part) return;
+
+    if (const Column *column = part->cells.Find(cellKey(x >> kCellShift, z >> kCellShift))) {
+      const uint32_t *slots = part->cells.Slots(*column);
+      const Cell *cell      = part->cells.Planes(*column);
+
+      for (size_t i = 0; !cell && i < column->count; i++) {
+        if (packed[slots[i]].box.Contains(x, y, z) && !f(record(slots[i]))) return;
+      }
+
+      for (size_t base = 0; cell && base < cell->Size(); base += LandSimd::kBlock) {
+        uint64_t mask = LandSimd::MaskPoint(cell->planes.data(), cell->stride, base, cell->End(base), x, y, z);
+
+        for (; mask; mask &= mask - 1) {
+          if (!f(record(slots[base + LandSimd::LowestBit(mask)]))) return;
+        }
+      }
+    }
+
+    part->large.Query(LandBox(x, y, z, x, y, z), [&](uint32_t slot, const LandBox &) { return f(record(slot)); });
+  }
+
+  // Calls f for every land intersecting the box, stops as soon as f returns false
+  template <typename F> void Overlapping(const int dim, const LandBox &box, F f) const {
+    const Partition *part = partition(dim);
+    if (!part) return;
+
+    if (cellCount(box) > kMaxQueryCells) {
+      part->tree.Query(box, [&](uint32_t slot, const LandBox &) { return f(record(slot)); });
+      return;
+    }
+
+    bool more = true;
+
+    forEachCell(box, [&](uint64_t key) {
+      const Column *column = more ? part->cells.Find(key) : nullptr;
+      if (!column) return;
+
+      const uint32_t *slots = part->cells.Slots(*column);
+      const Cell *cell      = part->cells.Planes(*column);
+
+      // A land shows up in every column it covers, report it only from the first one shared with the query
+      auto report = [&](uint32_t slot) {
+        const LandBox &own = packed[slot].box;
+
+        int cx = std::max(own.X1, box.X1) >> kCellShift;
+        int cz = std::max(own.Z1, box.Z1) >> kCellShift;
+
+        if (cellKey(cx, cz) == key) more = f(record(slot));
+      };
+
+      for (size_t i = 0; !cell && more && i < column->count; i++) {
+        if (packed[slots[i]].box.Intersects(box)) report(slots[i]);
+      }
+
+      for (size_t base = 0; cell && more && base < cell->Size(); base += LandSimd::kBlock) {
+        uint64_t mask = LandSimd::MaskBox(cell->planes.data(), cell->stride, base, cell->End(base), box);
+        for (; more && mask; mask &= mask - 1) report(slots[base + LandSimd::LowestBit(mask)]);
+      }
+    });
+
+    if (more) part->large.Query(box, [&](uint32_t slot, const LandBox &) { return f(record(slot)); });
+  }
+
+  // Calls f(land, distance) for every land within radius blocks of the block, nearest first, with the squared distance
+  // to its closest block. Stops as soon as f returns false.
+  template <typename F>
+  void Nearest(const int dim, const int x, const int y, const int z, const int radius, F f) const {
+    const Partition *part = partition(dim);
+    if (!part) return;
+
+    int64_t limit = (int64_t) radius * radius;
+
+    part->tree.Nearest(x, y, z, [&](uint32_t slot, const LandBox &, int64_t distance) {
+      return distance <= limit && f(record(slot), distance);
+    });
+  }
+
+private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  // Low byte of the flags is the dimension, the bits from kDepthShift up the nesting depth
+  static constexpr uint32_t kLive       = 1 << 8;
+  static constexpr uint32_t kLarge      = 1 << 9;
+  static constexpr uint32_t kDepthShift = 10;
+
+  struct PackedLand {
+    LandBox box;
+
+    // Interned owner, or the next free slot while this one is free
+    uint32_t owner;
+
+    // Into trustSets, 0 when nobody is trusted
+    uint32_t trust;
+    uint32_t flags;
+  };
+
+  static_assert(sizeof(PackedLand) < 40, "packed land records must stay under 40 bytes");
+
+  inline LandRecord record(uint32_t slot) const {
+    const PackedLand &land = packed[slot];
+
+    LandRecord out;
+    out.id      = ids[slot];
+    out.owner   = ownerXuids[land.owner];
+    out.dim     = (int32_t) (land.flags & 0xFF);
+    out.box     = land.box;
+    out.depth   = (int32_t) (land.flags >> kDepthShift);
+    out.trusted = land.trust ? &trustSets[land.trust] : nullptr;
+    return out;
+  }
+
+  static inline uint64_t cellKey(const int cx, const int cz) {
+    return ((uint64_t) (uint32_t) cx << 32) | (uint32_t) cz;
+  }
+  static int64_t cellCount(const LandBox &box);
+  static inline bool isOversize(const LandBox &box) { return cellCount(box) > kMaxCells; }
+
+  void account(uint64_t owner, const LandBox &box, int sign);
+  bool insert(const LandRecord &land, bool counted);
+  bool erase(int64_t id, bool counted);
+  static size_t footprint(const LandBox &box);
+
+  uint32_t internOwner(uint64_t xuid);
+  void releaseOwner(uint32_t owner);
+  uint32_t allocateTrust();
+  void releaseTrust(uint32_t trust);
+
+  // Open addressing from database id to slot, the table only holds slots and compares against their ids
+  static inline size_t hashId(int64_t id) {
+    uint64_t mixed = (uint64_t) id * 0x9E3779B97F4A7C15ull;
+    return (size_t) (mixed ^ mixed >> 29);
+  }
+  uint32_t slotOf(int64_t id) const;
+  void link(uint32_t slot);
+  void unlink(uint32_t slot);
+
+  static inline uint32_t generationSlot(int dim, uint64_t key) {
+    uint64_t mixed = key ^ (uint64_t) dim * 0xC2B2AE3D27D4EB4Full;
+    return (uint32_t) ((mixed * 0x9E3779B97F4A7C15ull) >> (64 - kGenerationBits));
+  }
+
+  // Invalidates decisions taken in the columns the box covers
+  void touch(int dim, const LandBox &box);
+
+  template <typename F> static void forEachCell(const LandBox &box, F f) {
+    for (int cx = box.X1 >> kCellShift; cx <= box.X2 >> kCellShift; cx++)
+      for (int cz = box.Z1 >> kCellShift; cz <= box.Z2 >> kCellShift; cz++) f(cellKey(cx, cz));
+  }
+
+  // Lands sharing a column. Once there are enough of them their bounds are also kept as SIMD planes, a column with
+  // only a few is scanned straight from the packed lands since its planes would be mostly padding.
+  struct Cell {
+    static constexpr size_t kScalarLands = LandSimd::kPad;
+
+    std::vector<int32_t> planes;
+    std::vector<uint32_t> slots;
+    size_t stride = 0;
+
+    void Push(uint32_t slot, const std::vector<PackedLand> &packed);
+    void Remove(uint32_t slot);
+    void put(size_t i, const LandBox &box);
+
+    inline size_t Size() const { return slots.size(); }
+
+    // Padded end of the block starting at base
+    inline size_t End(size_t base) const {
+      size_t end = base + LandSimd::kBlock < Size() ? base + LandSimd::kBlock : Size();
+      return (end + LandSimd::kPad - 1) / LandSimd::kPad * LandSimd::kPad;
+    }
+  };
+
+  // A column of up to kInline lands keeps their slots in its entry, a busier one spills them into a Cell and keeps
+  // its index in slots[0]
+  struct Column {
+    static constexpr uint32_t kInline = 3;
+
+    uint64_t key;
+    uint32_t count;
+    uint32_t slots[kInline];
+  };
+
+  // Open addressing from column key to column. Most columns hold a single land, they take one flat entry and no
+  // allocation of their own.
+  struct ColumnTable {
+    // No block coordinate shifted down to a column reaches INT32_MIN
+    static constexpr uint64_t kFree = 0x8000000080000000ull;
+
+    std::vector<Column> entries;
+    std::vector<Cell> spilled;
+    std::vector<uint32_t> freeSpilled;
+    size_t size = 0;
+
+    static inline size_t hash(uint64_t key) {
+      key ^= key >> 33;
+      key *= 0xff51afd7ed558ccdull;
+      key ^= key >> 33;
+      return (size_t) key;
+    }
+
+    inline const Column *Find(uint64_t key) const {
+      if (entries.empty()) return nullptr;
+
+      size_t mask = entries.size() - 1;
+
+      for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+        if (entries[i].key == key) return &entries[i];
+        if (entries[i].key == kFree) return nullptr;
+      }
+    }
+
+    inline const uint32_t *Slots(const Column &column) const {
+      return column.count > Column::kInline ? spilled[column.slots[0]].slots.data() : column.slots;
+    }
+
+    // The spilled cell when it keeps SIMD planes, nullptr when the column is scanned slot by slot
+    inline const Cell *Planes(const Column &column) const {
+      if (column.count <= Column::kInline) return nullptr;
+
+      const Cell &cell = spilled[column.slots[0]];
+      return cell.stride ? &cell : nullptr;
+    }
+
+    void Push(uint64_t key, uint32_t slot, const std::vector<PackedLand> &packed);
+    void Remove(uint64_t key, uint32_t slot);
+    void Clear();
+    void grow();
+  };
+
+  // Columns and trees of one dimension
+  struct Partition {
+    ColumnTable cells;
+    AabbTree tree;
+    AabbTree large;
+  };
+
+  inline Partition *partition(int dim) { return dim >= 0 && dim < kDimensions ? &partitions[dim] : nullptr; }
+  inline const Partition *partition(int dim) const {
+    return dim >= 0 && dim < kDimensions ? &partitions[dim] : nullptr;
+  }
+
+  // Indexed by slot: the land, its database id and its leaf in the partition tree
+  std::vector<PackedLand> packed;
+  std::vector<int64_t> ids;
+  std::vector<int32_t> nodes;
+  uint32_t freeSlot = kNone;
+  size_t live       = 0;
+
+  std::vector<uint32_t> table;
+
+  // Oversize lands are also in the large tree, there are few of them
+  std::unordered_map<uint32_t, int32_t> largeNodes;
+
+  // Interned owners with the number of resident lands using them
+  std::vector<uint64_t> ownerXuids;
+  std::vector<uint32_t> ownerRefs;
+  std::vector<uint32_t> freeOwners;
+  std::unordered_map<uint64_t, uint32_t> ownerSlots;
+
+  // Slot 0 stays empty so a zero trust index means nobody
+  std::vector<TrustSet> trustSets;
+  std::vector<uint32_t> freeTrusts;
+
+  std::unordered_map<uint64_t, OwnerTotals> owners;
+  Partition partitions[kDimensions];
+  std::unordered_set<uint64_t> held;
+  size_t bytes = 0;
+
+  // Bumped on every change to a column, or to any oversize land for global
+  uint32_t generations[1 << kGenerationBits] = {};
+  uint32_t global                            = 0;
+  uint64_t changes                           = 0;
+
+  // Ring of the mutations behind the last kRecentChanges changes, none from before cleared
+  std::vector<LandMutation> recent;
+  uint64_t cleared = 0;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "landbox.h"
+
+// Public API for other mods, link against LandManager and include this header.
+
+#if defined(_WIN32)
+#ifdef LandManager_EXPORTS
+#define LANDMANAGERAPI __declspec(dllexport)
+#else
+#define LANDMANAGERAPI __declspec(dllimport)
+#endif
+#else
+#define LANDMANAGERAPI
+#endif
+
+// Dimension ids as the game numbers them
+enum LandDimension { Overworld = 0, Nether = 1, TheEnd = 2 };
+
+struct LandBlock {
+  int X = 0, Y = 0, Z = 0;
+};
+
+// Bulk permission checks for explosions, pistons, fluids and editing tools. Each call walks the land index once no
+// matter how many blocks it covers. Pass xuid 0 for changes nobody caused, they are denied inside every land.
+namespace LandManager {
+// True if the player may modify every block of the box in dimension dim
+LANDMANAGERAPI bool MayModify(uint64_t xuid, int dim, const LandBox &box);
+
+// The parts of the box the player may not modify, clipped to the query. A land in the way can take several boxes
+// when lands nested in it let the player through, the boxes never overlap.
+LANDMANAGERAPI std::vector<LandBox> DeniedRegions(uint64_t xuid, int dim, const LandBox &box);
+
+// Bit i % 64 of word i / 64 is set when the player may modify blocks[i]
+LANDMANAGERAPI std::vector<uint64_t> AllowedBlocks(uint64_t xuid, int dim, const std::vector<LandBlock> &blocks);
+} // namespace LandManager
@@ -0,0 +1,228 @@
+#include "landsimd.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LAND_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define LAND_TARGET(isa)
+#else
+#define LAND_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace {
+
+enum Plane { X1, Y1, Z1, X2, Y2, Z2 };
+
+uint64_t pointScalar(const int32_t *planes, size_t stride, size_t base, size_t end, int x, int y, int z) {
+  const int32_t *p = planes;
+  uint64_t mask    = 0;
+
+  for (size_t i = base; i < end; i++) {
+    bool inside = x >= p[X1 * stride + i] && x <= p[X2 * stride + i] && y >= p[Y1 * stride + i] &&
+                  y <= p[Y2 * stride + i] && z >= p[Z1 * stride + i] && z <= p[Z2 * stride + i];
+    mask |= (uint64_t) inside << (i - base);
+  }
+
+  return mask;
+}
+
+uint64_t boxScalar(const int32_t *planes, size_t stride, size_t base, size_t end, const LandBox &box) {
+  const int32_t *p = planes;
+  uint64_t mask    = 0;
+
+  for (size_t i = base; i < end; i++) {
+    bool hit = box.X1 <= p[X2 * stride + i] && box.X2 >= p[X1 * stride + i] && box.Y1 <= p[Y2 * stride + i] &&
+               box.Y2 >= p[Y1 * stride + i] && box.Z1 <= p[Z2 * stride + i] && box.Z2 >= p[Z1 * stride + i];
+    mask |= (uint64_t) hit << (i - base);
+  }
+
+  return mask;
+}
+
+#ifdef LAND_SIMD_X86
+
+#define LOAD8(plane, i) _mm256_loadu_si256((const __m256i *) (planes + (plane) * stride + (i)))
+#define LOAD16(plane, i) _mm512_loadu_si512(planes + (plane) * stride + (i))
+
+// A lane misses when any min is above the probe or any max is below it
+LAND_TARGET("avx2")
+uint64_t pointAvx2(const int32_t *planes, size_t stride, size_t base, size_t end, int x, int y, int z) {
+  const __m256i vx = _mm256_set1_epi32(x);
+  const __m256i vy = _mm256_set1_epi32(y);
+  const __m256i vz = _mm256_set1_epi32(z);
+  uint64_t mask    = 0;
+
+  for (size_t i = base; i < end; i += 8) {
+    __m256i miss = _mm256_or_si256(_mm256_cmpgt_epi32(LOAD8(X1, i), vx), _mm256_cmpgt_epi32(vx, LOAD8(X2, i)));
+    miss         = _mm256_or_si256(miss, _mm256_cmpgt_epi32(LOAD8(Y1, i), vy));
+    miss         = _mm256_or_si256(miss, _mm256_cmpgt_epi32(vy, LOAD8(Y2, i)));
+    miss         = _mm256_or_si256(miss, _mm256_cmpgt_epi32(LOAD8(Z1, i), vz));
+    miss         = _mm256_or_si256(miss, _mm256_cmpgt_epi32(vz, LOAD8(Z2, i)));
+
+    uint32_t lanes = ~(uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(miss)) & 0xFF;
+    mask |= (uint64_t) lanes << (i - base);
+  }
+
+  return mask;
+}
+
+LAND_TARGET("avx2")
+uint64_t boxAvx2(const int32_t *planes, size_t stride, size_t base, size_t end, const LandBox &box) {
+  const __m256i x1 = _mm256_set1_epi32(box.X1), x2 = _mm256_set1_epi32(box.X2);
+  const __m256i y1 = _mm256_set1_epi32(box.Y1), y2 = _mm256_set1_epi32(box.Y2);
+  const __m256i z1 = _mm256_set1_epi32(box.Z1), z2 = _mm256_set1_epi32(box.Z2);
+  uint64_t mask    = 0;
+
+  for (size_t i = base; i < end; i += 8) {
+    __m256i miss = _mm256_or_si256(_mm256_cmpgt_epi32(x1, LOAD8(X2, i)), _mm256_cmpgt_epi32(LOAD8(X1, i), x2));
+    miss         = _mm256_or_si256(miss, _mm256_cmpgt_epi32(y1, LOAD8(Y2, i)));
+    miss         = _mm256_or_si256(miss, _mm256_cmpgt_epi32(LOAD8(Y1, i), y2));
+    miss         = _mm256_or_si256(miss, _mm256_cmpgt_epi32(z1, LOAD8(Z2, i)));
+    miss         = _mm256_or_si256(miss, _mm256_cmpgt_epi32(LOAD8(Z1, i), z2));
+
+    uint32_t lanes = ~(uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(miss)) & 0xFF;
+    mask |= (uint64_t) lanes << (i - base);
+  }
+
+  return mask;
+}
+
+LAND_TARGET("avx512f")
+uint64_t pointAvx512(const int32_t *planes, size_t stride, size_t base, size_t end, int x, int y, int z) {
+  const __m512i vx = _mm512_set1_epi32(x);
+  const __m512i vy = _mm512_set1_epi32(y);
+  const __m512i vz = _mm512_set1_epi32(z);
+  uint64_t mask    = 0;
+
+  for (size_t i = base; i < end; i += 16) {
+    __mmask16 hit = _mm512_cmple_epi32_mask(LOAD16(X1, i), vx);
+    hit           = _mm512_mask_cmpge_epi32_mask(hit, LOAD16(X2, i), vx);
+    hit           = _mm512_mask_cmple_epi32_mask(hit, LOAD16(Y1, i), vy);
+    hit           = _mm512_mask_cmpge_epi32_mask(hit, LOAD16(Y2, i), vy);
+    hit           = _mm512_mask_cmple_epi32_mask(hit, LOAD16(Z1, i), vz);
+    hit           = _mm512_mask_cmpge_epi32_mask(hit, LOAD16(Z2, i), vz);
+
+    mask |= (uint64_t) hit << (i - base);
+  }
+
+  return mask;
+}
+
+LAND_TARGET("avx512f")
+uint64_t boxAvx512(const int32_t *planes, size_t stride, size_t base, size_t end, const LandBox &box) {
+  const __m512i x1 = _mm512_set1_epi32(box.X1), x2 = _mm512_set1_epi32(box.X2);
+  const __m512i y1 = _mm512_set1_epi32(box.Y1), y2 = _mm512_set1_epi32(box.Y2);
+  const __m512i z1 = _mm512_set1_epi32(box.Z1), z2 = _mm512_set1_epi32(box.Z2);
+  uint64_t mask    = 0;
+
+  for (size_t i = base; i < end; i += 16) {
+    __mmask16 hit = _mm512_cmple_epi32_mask(LOAD16(X1, i), x2);
+    hit           = _mm512_mask_cmpge_epi32_mask(hit, LOAD16(X2, i), x1);
+    hit           = _mm512_mask_cmple_epi32_mask(hit, LOAD16(Y1, i), y2);
+    hit           = _mm512_mask_cmpge_epi32_mask(hit, LOAD16(Y2, i), y1);
+    hit           = _mm512_mask_cmple_epi32_mask(hit, LOAD16(Z1, i), z2);
+    hit           = _mm512_mask_cmpge_epi32_mask(hit, LOAD16(Z2, i), z1);
+
+    mask |= (uint64_t) hit << (i - base);
+  }
+
+  return mask;
+}
+
+#undef LOAD8
+#undef LOAD16
+
+void cpuid(int leaf, int subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+  __cpuidex((int *) regs, leaf, subleaf);
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// The OS has to save the wide registers on context switches too, not only the CPU support them
+uint64_t enabledState() {
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t) edx << 32) | eax;
+#endif
+}
+
+#endif
+
+LandSimd::Level current = LandSimd::Level::Scalar;
+
+} // namespace
+
+LandSimd::PointFn LandSimd::MaskPoint = pointScalar;
+LandSimd::BoxFn LandSimd::MaskBox     = boxScalar;
+
+LandSimd::Level LandSimd::Detect() {
+#ifdef LAND_SIMD_X86
+  uint32_t regs[4];
+
+  cpuid(0, 0, regs);
+  if (regs[0] < 7) return Level::Scalar;
+
+  cpuid(1, 0, regs);
+  bool osxsave = regs[2] & (1u << 27);
+  if (!osxsave) return Level::Scalar;
+
+  uint64_t state = enabledState();
+  cpuid(7, 0, regs);
+
+  bool avx2   = (regs[1] & (1u << 5)) && (state & 0x6) == 0x6;
+  bool avx512 = (regs[1] & (1u << 16)) && (state & 0xE6) == 0xE6;
+
+  if (avx512) return Level::Avx512;
+  if (avx2) return Level::Avx2;
+#endif
+
+  return Level::Scalar;
+}
+
+LandSimd::Level LandSimd::Current() { return current; }
+
+void LandSimd::Select(Level level) {
+  if (level > Detect()) level = Detect();
+
+  current = level;
+
+  switch (level) {
+#ifdef LAND_SIMD_X86
+  case Level::Avx512:
+    MaskPoint = pointAvx512;
+    MaskBox   = boxAvx512;
+    break;
+  case Level::Avx2:
+    MaskPoint = pointAvx2;
+    MaskBox   = boxAvx2;
+    break;
+#endif
+  default:
+    MaskPoint = pointScalar;
+    MaskBox   = boxScalar;
+    break;
+  }
+}
+
+const char *LandSimd::Name(Level level) {
+  switch (level) {
+  case Level::Avx512: return "avx512";
+  case Level::Avx2: return "avx2";
+  default: return "scalar";
+  }
+}
+
+// Pick the widest kernel once at load time
+static const bool selected = (LandSimd::Select(LandSimd::Detect()), true);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#include "landbox.h"
+
+// Batched containment and intersection tests over structure-of-arrays land bounds.
+//
+// Bounds are stored as six planes of `stride` ints each, in X1, Y1, Z1, X2, Y2, Z2 order. Every call tests the lands
+// in [base, end), at most kBlock of them, and returns one bit per land. end - base must be a multiple of kPad, unused
+// slots hold kEmptyMin/kEmptyMax bounds which never match. The widest kernel the CPU supports is picked at startup.
+namespace LandSimd {
+enum class Level { Scalar, Avx2, Avx512 };
+
+static constexpr size_t kBlock = 64;
+static constexpr size_t kPad   = 16;
+
+static constexpr int32_t kEmptyMin = INT32_MAX;
+static constexpr int32_t kEmptyMax = INT32_MIN;
+
+using PointFn = uint64_t (*)(const int32_t *planes, size_t stride, size_t base, size_t end, int x, int y, int z);
+using BoxFn   = uint64_t (*)(const int32_t *planes, size_t stride, size_t base, size_t end, const LandBox &box);
+
+extern PointFn MaskPoint;
+extern BoxFn MaskBox;
+
+// Index of the lowest set bit, mask must not be zero
+inline int LowestBit(uint64_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanForward64(&index, mask);
+  return (int) index;
+#else
+  return __builtin_ctzll(mask);
+#endif
+}
+
+Level Detect();
+Level Current();
+void Select(Level level);
+const char *Name(Level level);
+} // namespace LandSimd
@@ -0,0 +1,331 @@
+#include "listing.h"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#include "database.h"
+#include "region.h"
+#include "stats.h"
+
+DEF_LOGGER("LandManager");
+
+namespace {
+
+constexpr int kPageSize      = 8;
+constexpr int kNearLands     = 8;
+constexpr int kDefaultRadius = 64;
+constexpr int kMaxRadius     = 256;
+
+// Lands in the way of a selection listed by id, any more are only counted
+constexpr size_t kListedConflicts = 4;
+
+// A list reads the table, it may wait this long for the writer to store the player's last purchases
+constexpr std::chrono::milliseconds kWriterTimeout = std::chrono::milliseconds(250);
+
+const char *dimensionName(int dim) {
+  static const char *names[] = {"Overworld", "Nether", "End"};
+  return dim >= 0 && dim < 3 ? names[dim] : "?";
+}
+
+// Every row is printed into a stack buffer and appended to the one message
+template <typename... Args> void append(std::string &out, const char *format, Args... args) {
+  char line[160];
+  int length = std::snprintf(line, sizeof(line), format, args...);
+  if (length > 0) out.append(line, std::min<size_t>(length, sizeof(line) - 1));
+}
+
+void appendLand(std::string &out, int64_t id, int dim, const LandBox &box) {
+  append(
+      out, "\n#%lld %s (%d, %d, %d) a (%d, %d, %d), %lld bloques", (long long) id, dimensionName(dim), box.X1, box.Y1,
+      box.Z1, box.X2, box.Y2, box.Z2, (long long) box.Volume());
+}
+
+// Lands holding the whole selection would hold the new land, every other one is in the way. Only the deepest holder
+// and the lowest ids in the way are kept, so any number of lands can be fed through.
+struct PreviewSummary {
+  LandBox box;
+  size_t conflicts = 0;
+  size_t listed    = 0;
+  LandRecord first[kListedConflicts];
+  bool hasParent = false;
+  LandRecord parent;
+
+  PreviewSummary(const LandBox &box) : box(box) {}
+
+  void Add(const LandRecord &land) {
+    if (land.box.Contains(box)) {
+      if (!hasParent || land.depth > parent.depth) parent = land;
+      hasParent = true;
+      return;
+    }
+
+    conflicts++;
+
+    size_t at = listed;
+    while (at > 0 && first[at - 1].id > land.id) at--;
+    if (at == kListedConflicts) return;
+
+    for (size_t i = std::min(listed, kListedConflicts - 1); i > at; i--) first[i] = first[i - 1];
+    first[at] = land;
+    listed    = std::min(listed + 1, kListedConflicts);
+  }
+};
+
+} // namespace
+
+std::string LandManager::ListLands(Mod::PlayerEntry player, int page, ListCursor &cursor) {
+  ScopedTimer timer(landStats[Probe::ListLands]);
+
+  // Both seek on (owner, id), ascending skips rows only when jumping to a page away from the one last shown
+  static SQLite::Statement after{
+      *landDB, "SELECT id, dim, x1, y1, z1, x2, y2, z2 FROM lands WHERE owner = ? AND id > ? "
+               "ORDER BY id LIMIT ? OFFSET ?"};
+  static SQLite::Statement before{
+      *landDB, "SELECT id, dim, x1, y1, z1, x2, y2, z2 FROM lands WHERE owner = ? AND id < ? ORDER BY id DESC LIMIT ?"};
+
+  // The running totals say how many pages there are without counting rows
+  int total = landIndex.Read()->Totals(player.xuid).lands;
+  if (total <= 0) return "[Zonas] No tienes ninguna zona.";
+
+  int pages = (total + kPageSize - 1) / kPageSize;
+  page      = std::clamp(page, 1, pages);
+
+  if (!LandManager::WaitForOwner(player.xuid, kWriterTimeout)) {
+    return "[Zonas] La base de datos esta ocupada, intenta de nuevo mas tarde.";
+  }
+
+  // The previous page and the last one are read backwards from the id they end before
+  bool backwards = false;
+  int64_t key    = INT64_MIN;
+  int64_t skip   = (int64_t) (page - 1) * kPageSize;
+  int limit      = kPageSize;
+
+  if (cursor.page && page >= cursor.page) {
+    key  = page == cursor.page ? cursor.first - 1 : cursor.last;
+    skip = (int64_t) std::max(page - cursor.page - 1, 0) * kPageSize;
+  } else if (cursor.page && page == cursor.page - 1) {
+    backwards = true;
+    key       = cursor.first;
+  }
+
+  if (skip && page == pages) {
+    backwards = true;
+    key       = INT64_MAX;
+    limit     = total - (pages - 1) * kPageSize;
+  }
+
+  SQLite::Statement &stmt = backwards ? before : after;
+
+  BOOST_SCOPE_EXIT_ALL(&) {
+    stmt.clearBindings();
+    stmt.tryReset();
+  };
+
+  struct Row {
+    int64_t id;
+    int dim;
+    LandBox box;
+  };
+
+  std::vector<Row> rows;
+  rows.reserve(kPageSize);
+
+  try {
+    stmt.bind(1, (int64_t) player.xuid);
+    stmt.bind(2, key);
+    stmt.bind(3, limit);
+    if (!backwards) stmt.bind(4, skip);
+
+    while (stmt.executeStep()) {
+      LandBox box(
+          stmt.getColumn(2).getInt(), stmt.getColumn(3).getInt(), stmt.getColumn(4).getInt(),
+          stmt.getColumn(5).getInt(), stmt.getColumn(6).getInt(), stmt.getColumn(7).getInt());
+
+      rows.push_back(Row{stmt.getColumn(0).getInt64(), stmt.getColumn(1).getInt(), box});
+    }
+  } catch (SQLite::Exception const &ex) {
+    LOGE("[LM] Failed to list the lands of %d: %s") % player.xuid % ex.what();
+    return "[Zonas] Ocurrio un error al buscar tus zonas.";
+  }
+
+  if (backwards) std::reverse(rows.begin(), rows.end());
+
+  // Sold lands can leave the page the cursor pointed at empty, the next list starts over from the first land
+  cursor = rows.empty() ? ListCursor() : ListCursor{page, rows.front().id, rows.back().id};
+
+  std::string out;
+  out.reserve(64 + kPageSize * 96);
+  append(out, "[Zonas] Tienes %d zonas, pagina %d de %d:", total, page, pages);
+
+  for (const Row &row : rows) appendLand(out, row.id, row.dim, row.box);
+  return out;
+}
+
+std::string LandManager::NearLands(Vector3 block, int radius) {
+  ScopedTimer timer(landStats[Probe::NearLands]);
+
+  radius = std::clamp(radius > 0 ? radius : kDefaultRadius, 1, kMaxRadius);
+
+  LandBox around(
+      block.X - radius, block.Y - radius, block.Z - radius, block.X + radius, block.Y + radius, block.Z + radius);
+
+  auto &playerdb = Mod::PlayerDatabase::GetInstance();
+  int found      = 0;
+
+  std::string out;
+  out.reserve(64 + kNearLands * 128);
+  append(out, "[Zonas] Zonas a menos de %d bloques:", radius);
+
+  auto report = [&](const LandRecord &land, int64_t distance) {
+    appendLand(out, land.id, land.dim, land.box);
+
+    // Owners who are offline are shown by xuid, looking up their name would mean a query per row
+    auto owner = playerdb.Find(land.owner);
+
+    if (owner) {
+      out += " de ";
+      out += owner->name;
+    } else {
+      append(out, " del jugador %llu", (unsigned long long) land.owner);
+    }
+
+    if (distance == 0) {
+      out += ", estas dentro";
+    } else {
+      append(out, ", a %lld bloques", (long long) std::ceil(std::sqrt((double) distance)));
+    }
+
+    return ++found < kNearLands;
+  };
+
+  regions.Read(block.Dim, around)->Nearest(block.Dim, block.X, block.Y, block.Z, radius, report);
+
+  if (found == 0) append(out, "\nNinguna.");
+  return out;
+}
+
+std::string LandManager::PreviewSelection(
+    Mod::PlayerEntry player, Vector3 start, Vector3 end, SelectionPreview &preview) {
+  LandBox box = Cube(start, end).Box();
+  int dim     = start.Dim;
+
+  uint64_t changes = landIndex.Read()->Changes();
+  bool current     = preview.valid && preview.dim == dim && preview.changes == changes;
+
+  if (current && preview.box == box) return "";
+
+  ScopedTimer timer(landStats[Probe::PreviewSelection]);
+
+  if (start.Dim != end.Dim) return "[Zonas] Los dos puntos deben estar en la misma dimension.";
+
+  // Lands from the last preview that still touch the selection stay, only what it grew into is looked up
+  LandBox grown[6];
+  size_t pieces = 0;
+
+  if (current && preview.complete) {
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < preview.count; i++) {
+      if (preview.touching[i].box.Intersects(box)) preview.touching[kept++] = preview.touching[i];
+    }
+
+    preview.count = kept;
+    box.Subtract(preview.box, [&](const LandBox &piece) { grown[pieces++] = piece; });
+  } else {
+    preview.count   = 0;
+    grown[pieces++] = box;
+  }
+
+  PreviewSummary summary(box);
+  bool complete = true;
+
+  {
+    // Every piece lies inside the selection, so does the full scan when there are too many to keep
+    auto index = regions.Read(dim, box);
+
+    // A land reaching into several pieces, or kept and reaching into a new one, is only added once
+    auto kept = [&](int64_t id) {
+      for (uint32_t i = 0; i < preview.count; i++) {
+        if (preview.touching[i].id == id) return true;
+      }
+      return false;
+    };
+
+    for (size_t i = 0; i < pieces && complete; i++) {
+      index->Overlapping(dim, grown[i], [&](const LandRecord &land) {
+        if (kept(land.id)) return true;
+
+        if (preview.count == SelectionPreview::kMaxTouching) {
+          complete = false;
+          return false;
+        }
+
+        // The trust set belongs to the copy we read from
+        LandRecord &copy = preview.touching[preview.count++];
+        copy             = land;
+        copy.trusted     = nullptr;
+        return true;
+      });
+    }
+
+    // Too many to keep, the whole selection is summed up straight from the index
+    if (!complete) {
+      preview.count = 0;
+
+      index->Overlapping(dim, box, [&](const LandRecord &land) {
+        summary.Add(land);
+        return true;
+      });
+    }
+  }
+
+  for (uint32_t i = 0; i < preview.count; i++) summary.Add(preview.touching[i]);
+
+  // A mutation since the changes were read makes the next preview start over
+  preview.valid    = true;
+  preview.complete = complete;
+  preview.dim      = dim;
+  preview.box      = box;
+  preview.changes  = changes;
+
+  int64_t volume = box.Volume();
+  bool buyable   = summary.conflicts == 0;
+
+  std::string out;
+  out.reserve(160 + kListedConflicts * 96);
+  append(out, "[Zonas] Volumen: %lldU - Precio: %lldM.", (long long) volume, (long long) LandPrice(volume));
+
+  const LandRecord *parent = summary.hasParent ? &summary.parent : nullptr;
+
+  if (summary.conflicts) {
+    if (summary.conflicts == 1) {
+      append(out, "\n[Zonas] La seleccion choca con una zona:");
+    } else {
+      append(out, "\n[Zonas] La seleccion choca con %zu zonas:", summary.conflicts);
+    }
+
+    for (size_t i = 0; i < summary.listed; i++) appendLand(out, summary.first[i].id, dim, summary.first[i].box);
+
+    if (summary.conflicts > kListedConflicts) append(out, "\ny %zu mas.", summary.conflicts - kListedConflicts);
+  } else if (parent && parent->owner != player.xuid) {
+    append(out, "\n[Zonas] La seleccion esta dentro de la zona #%lld de otro jugador.", (long long) parent->id);
+    buyable = false;
+  } else if (parent && parent->depth >= LandIndex::kMaxDepth) {
+    append(out, "\n[Zonas] No puedes crear mas subzonas dentro de esta zona.");
+    buyable = false;
+  } else if (parent) {
+    append(out, "\n[Zonas] Sera una subzona de la zona #%lld.", (long long) parent->id);
+  }
+
+  if (landIndex.Read()->Totals(player.xuid).lands >= settings.limit) {
+    append(out, "\n[Zonas] Haz alcanzado el limite de zonas.");
+    buyable = false;
+  }
+
+  if (!buyable) landStats[Probe::PreviewSelection].Deny();
+
+  out += buyable ? " Compra esta zona con '/land buy' o sal con '/land exit'"
+                 : "\nAjusta el punto final o sal con '/land exit'";
+  return out;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+#include "settings.h"
+#include "session.h"
+
+// What players own and who owns what is around them, formatted as chat messages.
+namespace LandManager {
+// One page of the lands the player owns, oldest first. Pages past the last show the last one. The page shown is left
+// in the cursor, so the ones next to it, the first and the last are read without skipping rows.
+std::string ListLands(Mod::PlayerEntry player, int page, ListCursor &cursor);
+
+// The lands closest to the block within radius blocks, nearest first with their owners. A radius of 0 or less picks
+// the default one.
+std::string NearLands(Vector3 block, int radius);
+
+// Volume, price, limit status and the lands in the way of the selection between the two points. Empty when it is the
+// selection already previewed and nothing changed since, so holding a click costs nothing. Every new end point is
+// previewed, the one shown is always the latest.
+std::string PreviewSelection(Mod::PlayerEntry player, Vector3 start, Vector3 end, SelectionPreview &preview);
+} // namespace LandManager
@@ -1,3 +1,5 @@
+#include <cstdio>
+#include <sstream>
 #include <algorithm>
 
 #include <Block/BlockSource.h>
@@ -14,72 +16,221 @@
 #include <hook.h>
 #include <command.h>
 #include <audit.h>
+#include <economy.h>
+#include <scheduler.h>
 
-#include "settings.h"
+#include "database.h"
+#include "session.h"
+#include "region.h"
+#include "rent.h"
+#include "stats.h"
+#include "trace.h"
+#include "listing.h"
 
 std::unique_ptr<SQLite::Database> landDB;
-Action action;
-Vector3 pointA;
-Vector3 pointB;
+SharedLandIndex landIndex;
+SessionTable sessions;
+RegionCache regions;
+TraceRecorder tracer;
 
 DEF_LOGGER("LandManager");
 DEFAULT_SETTINGS(settings);
 
 void dllenter() {}
-void dllexit() {}
+void dllexit() {
+  tracer.Stop();
+  joinBulkJob();
+  if (LandManager::FlushDatabase()) LandManager::SaveSnapshot();
+}
 
 void checkAction(Mod::PlayerEntry const &, Mod::PlayerAction const &, Mod::CallbackToken<std::string> &);
 void checkInventoryTransaction(
     Mod::PlayerEntry const &, ComplexInventoryTransaction const &, Mod::CallbackToken<std::string> &);
+static void tick();
 
 void PreInit() {
   LOGV("[LM] PreInit");
 
   LandManager::InitDatabase();
 
+  if (!settings.trace.empty() && !tracer.Start(settings.trace, (int64_t) settings.traceSize << 20)) {
+    LOGE("[LM] Failed to open the trace file %s") % settings.trace;
+  }
+
   Mod::CommandSupport::GetInstance().AddListener(SIG("loaded"), initCommand);
   Mod::AuditSystem::GetInstance().AddListener(SIG("action"), {Mod::RecursiveEventHandlerAdaptor(checkAction)});
   Mod::AuditSystem::GetInstance().AddListener(
       SIG("inventory_transaction"), {Mod::RecursiveEventHandlerAdaptor(checkInventoryTransaction)});
+
+  // Once a second of game ticks, on the server thread like the economy and the packets rent sends
+  Mod::Scheduler::SetInterval(Mod::Scheduler::GameTick(20), [](auto) { tick(); });
 }
 
 void PostInit() {}
 
+// Kinds a hook has no case for are named by number, the report can be asked for from any thread
+static std::string kindName(int kind, const char *prefix) { return prefix + (" #" + std::to_string(kind)); }
+
+static std::string actionName(int kind) {
+  switch ((PlayerActionType) kind) {
+  case PlayerActionType::START_BREAK: return "START_BREAK";
+  case PlayerActionType::CONTINUE_BREAK: return "CONTINUE_BREAK";
+  case PlayerActionType::INTERACT_BLOCK: return "INTERACT_BLOCK";
+  default: return kindName(kind, "action");
+  }
+}
+
+static std::string transactionName(int kind) {
+  switch ((ItemUseInventoryTransaction::Type) kind) {
+  case ItemUseInventoryTransaction::Type::USE_ITEM_ON: return "USE_ITEM_ON";
+  case ItemUseInventoryTransaction::Type::USE_ITEM: return "USE_ITEM";
+  case ItemUseInventoryTransaction::Type::DESTROY: return "DESTROY";
+  default: return kindName(kind, "item use");
+  }
+}
+
+static std::string actorUseName(int kind) {
+  switch ((ItemUseOnActorInventoryTransaction::Type) kind) {
+  case ItemUseOnActorInventoryTransaction::Type::INTERACT: return "ACTOR_INTERACT";
+  case ItemUseOnActorInventoryTransaction::Type::ATTACK: return "ACTOR_ATTACK";
+  case ItemUseOnActorInventoryTransaction::Type::ITEM_INTERACT: return "ACTOR_ITEM_INTERACT";
+  default: return kindName(kind, "actor use");
+  }
+}
+
+std::string statsReport() { return landStats.Report(actionName, transactionName, actorUseName); }
+
+static void dumpStats() {
+  std::istringstream report(statsReport());
+
+  for (std::string line; std::getline(report, line);) LOGI("[LM] %s") % line;
+}
+
+// Lands handled per tick, a backlog after a long stop is worked off over the next seconds instead of all at once
+static constexpr size_t kRentPerTick = 256;
+
+static void tell(Mod::PlayerEntry const &player, std::string const &text) {
+  auto packet = TextPacket::createTextPacket<TextPacketType::SystemMessage>(player.name, text, "");
+  player.player->sendNetworkPacket(packet);
+}
+
+// The rent for one interval, a share of what the land was bought for rounded up. Never negative, a payment must not
+// credit the owner whatever the settings say.
+static int64_t rentPrice(int64_t volume) {
+  int64_t price   = LandPrice(std::max<int64_t>(volume, 0));
+  int64_t percent = std::max(settings.rentPercent, 0);
+
+  if (price <= 0 || percent == 0) return 0;
+  if (price / 100 >= INT64_MAX / percent) return INT64_MAX;
+
+  return price / 100 * percent + (price % 100 * percent + 99) / 100;
+}
+
+// Charges the lands due by now. Debits and reclaimed lands of a tick commit together, owners who are offline or short
+// of money are retried until the grace period runs out.
+static void collectRent(int64_t now) {
+  std::vector<RentDue> due;
+  rents.Collect(now, kRentPerTick, due);
+
+  if (due.empty()) return;
+
+  ScopedTimer timer(landStats[Probe::CollectRent]);
+  auto &playerdb = Mod::PlayerDatabase::GetInstance();
+
+  Mod::Economy::Transaction ecoTrans;
+  LandManager::Transaction landTrans;
+
+  for (const RentDue &land : due) {
+    auto owner    = playerdb.Find(land.owner);
+    int64_t price = rentPrice(land.volume);
+
+    if (owner) {
+      auto balance = Mod::Economy::GetBalance(owner->player);
+      bool paid    = price <= balance &&
+                  (price == 0 || !Mod::Economy::UpdateBalance(owner->player, balance - price, "Land Rent."));
+
+      if (paid) {
+        // A land that fell behind starts its next interval now, arrears past the grace period are not charged twice
+        LandMutation renew;
+        renew.kind      = LandMutation::Kind::Renew;
+        renew.land.id   = land.id;
+        renew.paidUntil = std::max(land.paidUntil, now) + settings.rentInterval;
+
+        LandManager::Submit(renew);
+        if (price) tell(*owner, "[Zonas] Se cobraron " + std::to_string(price) + "M por la renta de una zona.");
+        continue;
+      }
+    }
+
+    if (now >= land.paidUntil + settings.rentGrace) {
+      LandMutation erase;
+      erase.kind    = LandMutation::Kind::Erase;
+      erase.land.id = land.id;
+
+      LandManager::Submit(erase);
+      landStats[Probe::CollectRent].Deny();
+      LOGI("[LM] Reclaimed land %d of %d, rent unpaid since %d") % land.id % land.owner % land.paidUntil;
+      continue;
+    }
+
+    if (owner) tell(*owner, "[Zonas] No cuentas con suficiente dinero para la renta de una zona.");
+    rents.Retry(land.id, std::min(now + RentBook::kRetry, land.paidUntil + settings.rentGrace));
+  }
+
+  ecoTrans.Commit();
+  landTrans.Commit();
+}
+
+// Rent and stats dumps run from the server tick, the hooks only check permissions and never pay for them
+static void tick() {
+  if (landStats.DumpDue(settings.statsInterval)) dumpStats();
+  reportBulkJob();
+
+  int64_t now = RentBook::Now();
+  if (rents.TickDue(now)) collectRent(now);
+}
+
 void checkAction(
     Mod::PlayerEntry const &player, Mod::PlayerAction const &pAction, Mod::CallbackToken<std::string> &token) {
-  std::ostringstream p;
+  ProbeStats &stats = landStats.Action((int) pAction.type);
+  ScopedTimer timer(stats);
 
   switch (pAction.type) {
   case PlayerActionType::START_BREAK:
   case PlayerActionType::CONTINUE_BREAK:
   case PlayerActionType::INTERACT_BLOCK: {
-    Vector3 point = Vector3(pAction.pos.x, pAction.pos.y, pAction.pos.z);
+    Vector3 point = Vector3(pAction.pos.x, pAction.pos.y, pAction.pos.z, (int) player.player->getDimensionId());
+
+    // Players who are not selecting a land have a session with no action
+    Session *session = sessions.Find(player.xuid);
 
-    if (action == Action::Create) {
-      if (!pointA.init) {
-        pointA = point;
+    if (session && session->action == Action::Create) {
+      if (!session->pointA.init) {
+        session->pointA = point;
 
         auto packet = TextPacket::createTextPacket<TextPacketType::SystemMessage>(
             player.name,
             "[Zonas] Punto inicial seleccionado, continua seleccionando el punto final o sal con '/land exit'", "");
         player.player->sendNetworkPacket(packet);
       } else {
-        pointB = point;
+        session->pointB = point;
 
-        int vol = pointA.Volume(pointB);
-
-        std::ostringstream text;
-
-        text << "[Zonas] Volumen: " << vol << "U - Precio: " << vol * settings.blockPrice
-             << "M. Compra esta zona con '/land buy' o sal con '/land exit'";
-
-        auto packet = TextPacket::createTextPacket<TextPacketType::SystemMessage>(player.name, text.str(), "");
-        player.player->sendNetworkPacket(packet);
+        // Every new end point is previewed right away, clicking the same one again sends nothing
+        std::string preview = LandManager::PreviewSelection(player, session->pointA, point, session->preview);
+        if (!preview.empty()) tell(player, preview);
       }
     }
 
-    bool hasPerm = LandManager::HasPerm(player, point);
-    if (!hasPerm) token("Blocked by SpawnProtection");
+    bool hasPerm = LandManager::CheckPerm(player, point);
+    if (tracer.Enabled()) {
+      tracer.Record(
+          TraceSource::Action, (int) pAction.type, player.xuid, point.Dim, point.X, point.Y, point.Z, hasPerm);
+    }
+
+    if (!hasPerm) {
+      stats.Deny();
+      token("Blocked by SpawnProtection");
+    }
 
     break;
   }
@@ -95,14 +246,25 @@ void checkInventoryTransaction(
   case ComplexInventoryTransaction::Type::ITEM_USE: {
     auto &data = (ItemUseInventoryTransaction const &) transaction;
 
+    ProbeStats &stats = landStats.Transaction((int) data.actionType);
+    ScopedTimer timer(stats);
+
     switch (data.actionType) {
     case ItemUseInventoryTransaction::Type::USE_ITEM_ON:
     case ItemUseInventoryTransaction::Type::USE_ITEM:
     case ItemUseInventoryTransaction::Type::DESTROY: {
-      Vector3 point = Vector3(data.pos.x, data.pos.y, data.pos.z);
-      bool hasPerm  = LandManager::HasPerm(entry, point);
+      Vector3 point    = Vector3(data.pos.x, data.pos.y, data.pos.z, (int) entry.player->getDimensionId());
+      bool hasPerm     = LandManager::CheckPerm(entry, point);
+      Session *session = sessions.Find(entry.xuid);
+
+      if (tracer.Enabled()) {
+        tracer.Record(
+            TraceSource::Transaction, (int) data.actionType, entry.xuid, point.Dim, point.X, point.Y, point.Z, hasPerm);
+      }
 
-      if (action == Action::Create || !hasPerm) {
+      // Selecting points must not place or use anything, but only for the player who is selecting
+      if ((session && session->action == Action::Create) || !hasPerm) {
+        stats.Deny();
         data.onTransactionError(*entry.player, InventoryTransactionError::Unexcepted);
         token("Blocked by SpawnProtection");
       }
@@ -111,12 +273,35 @@ void checkInventoryTransaction(
     }
   } break;
 
-    /*case ComplexInventoryTransaction::Type::ITEM_USE_ON_ACTOR: {
-      auto &data    = (ItemUseOnActorInventoryTransaction const &) transaction;
-      auto composed = data.playerPos + data.clickPos;
+  // Animals, item frames and armor stands inside a land belong to it. Combat sends these many times a second, so they
+  // take the same cached path as blocks and never reach the database.
+  case ComplexInventoryTransaction::Type::ITEM_USE_ON_ACTOR: {
+    auto &data = (ItemUseOnActorInventoryTransaction const &) transaction;
+
+    ProbeStats &stats = landStats.ActorUse((int) data.actionType);
+    ScopedTimer timer(stats);
+
+    auto composed = data.playerPos + data.clickPos;
+    bool hasPerm  = false;
+    Vector3 point;
+
+    // The position comes from the client, one that is not a number has no block to check and is refused
+    if (std::isfinite(composed.x) && std::isfinite(composed.y) && std::isfinite(composed.z)) {
+      point   = Vector3::Block(composed.x, composed.y, composed.z, (int) entry.player->getDimensionId());
+      hasPerm = LandManager::CheckPerm(entry, point);
+    }
+
+    if (tracer.Enabled() && point.init) {
+      tracer.Record(
+          TraceSource::ActorUse, (int) data.actionType, entry.xuid, point.Dim, point.X, point.Y, point.Z, hasPerm);
+    }
+
+    if (!hasPerm) {
+      stats.Deny();
       data.onTransactionError(*entry.player, InventoryTransactionError::Unexcepted);
       token("Blocked by SpawnProtection");
-    } break;*/
+    }
+  } break;
 
   default: break;
   }
@@ -0,0 +1,833 @@
+#include <deque>
+#include <mutex>
+#include <algorithm>
+#include <thread>
+#include <cstdio>
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "database.h"
+#include "region.h"
+#include "rent.h"
+#include "stats.h"
+
+DEF_LOGGER("LandManager");
+
+// Write-behind persistence.
+//
+// Mutations are applied to the resident index as soon as they are published and appended to a small binary journal,
+// then a dedicated writer thread group-commits them into SQLite. Publishing never waits for the disk: the writer
+// syncs the journal once per batch, so a crash loses at most what was published since, and callers that must know
+// their changes are on disk ask OnDurable. The journal alternates between two files so the one no longer appended to
+// can be dropped once everything in it is committed, anything left in them at startup was never committed and is
+// replayed in order by sequence number.
+
+namespace {
+
+struct JournalRecord {
+  uint64_t seq;
+  int64_t id;
+  uint64_t owner; // Or the player of a Trust or Untrust, or the paid-up time of a Renew
+  int32_t box[6];
+  uint32_t kind; // Low byte is the mutation kind, then the depth, high half the dimension
+  uint32_t checksum;
+};
+
+static_assert(sizeof(JournalRecord) == 56, "journal records must stay fixed size");
+
+constexpr size_t kBatchSize = 512;
+
+// Commits of a batch tried before it is taken apart, a batch that can never be stored must not hold up the rest
+constexpr int kMaxAttempts = 5;
+
+// Past this many recorded mutations recording stops and page-ins go back to the database. Each page-in only replays
+// the ones filed under its tile, so this bounds memory and not the cost of a page-in.
+constexpr size_t kMaxRecorded = 16384;
+
+// Past this many bytes the journal moves on to its other file, as soon as everything in that one is committed
+constexpr size_t kJournalLimit = 4 << 20;
+
+std::mutex journalMutex;
+std::FILE *journal    = nullptr;
+int journalFile       = 0;
+size_t journalBytes   = 0;
+uint64_t publishedSeq = 0;
+uint64_t syncedSeq    = 0;
+uint64_t retiredSeq   = 0; // Last sequence number in the file not appended to
+
+// Acknowledgements waiting for a sequence number to be synced or committed, oldest first
+std::deque<std::pair<uint64_t, std::function<void()>>> acks;
+bool acking = false;
+
+std::mutex queueMutex;
+std::condition_variable queueCv;
+std::condition_variable drainedCv;
+std::deque<std::pair<uint64_t, LandMutation>> queue;
+bool stopping = false;
+
+// Last sequence number queued that changes what an owner's lands look like in the table, and the last one changing a
+// land whose owner was not resident. Cleared whenever the queue drains.
+std::unordered_map<uint64_t, uint64_t> ownerSeqs;
+uint64_t unknownOwnerSeq = 0;
+
+// Recorded mutations in publish order, filed by land and, for inserts, by every tile the land is stored under
+std::vector<LandMutation> recorded;
+std::unordered_map<int64_t, std::vector<uint32_t>> recordedLands;
+std::unordered_map<uint64_t, std::vector<uint32_t>> recordedTiles;
+bool recording = false;
+
+std::thread writer;
+uint64_t committedSeq = 0;
+int64_t nextLandId    = 1;
+
+thread_local LandManager::Transaction *current = nullptr;
+
+uint32_t checksum(const JournalRecord &rec) {
+  // FNV-1a over everything but the checksum itself
+  auto bytes    = (const uint8_t *) &rec;
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < offsetof(JournalRecord, checksum); i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+JournalRecord encode(uint64_t seq, const LandMutation &mutation) {
+  JournalRecord rec{};
+  rec.seq    = seq;
+  rec.id     = mutation.land.id;
+  rec.owner  = mutation.land.owner;
+  rec.box[0] = mutation.land.box.X1;
+  rec.box[1] = mutation.land.box.Y1;
+  rec.box[2] = mutation.land.box.Z1;
+  rec.box[3] = mutation.land.box.X2;
+  rec.box[4] = mutation.land.box.Y2;
+  rec.box[5] = mutation.land.box.Z2;
+  rec.kind   = (uint32_t) mutation.kind | (uint32_t) mutation.land.depth << 8 | (uint32_t) mutation.land.dim << 16;
+
+  switch (mutation.kind) {
+  case LandMutation::Kind::Trust:
+  case LandMutation::Kind::Untrust: rec.owner = mutation.player; break;
+  case LandMutation::Kind::Renew: rec.owner = (uint64_t) mutation.paidUntil; break;
+  default: break;
+  }
+
+  rec.checksum = checksum(rec);
+  return rec;
+}
+
+LandMutation decode(const JournalRecord &rec) {
+  LandMutation mutation;
+  mutation.kind       = (LandMutation::Kind) (rec.kind & 0xFF);
+  mutation.land.id    = rec.id;
+  mutation.land.dim   = (int32_t) (rec.kind >> 16);
+  mutation.land.depth = (int32_t) (rec.kind >> 8 & 0xFF);
+  mutation.land.box   = LandBox(rec.box[0], rec.box[1], rec.box[2], rec.box[3], rec.box[4], rec.box[5]);
+
+  switch (mutation.kind) {
+  case LandMutation::Kind::Trust:
+  case LandMutation::Kind::Untrust: mutation.player = rec.owner; break;
+  case LandMutation::Kind::Renew: mutation.paidUntil = (int64_t) rec.owner; break;
+  default: mutation.land.owner = rec.owner; break;
+  }
+
+  return mutation;
+}
+
+void applyToDatabase(const LandMutation &mutation) {
+  static SQLite::Statement insert{
+      *landDB, "INSERT OR REPLACE INTO lands (id, owner, dim, x1, y1, z1, x2, y2, z2, chkx1, chky1, chkz1, chkx2, "
+               "chky2, chkz2, depth) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"};
+  static SQLite::Statement erase{*landDB, "DELETE FROM lands WHERE id = ?"};
+  static SQLite::Statement setOwner{*landDB, "UPDATE lands SET owner = ? WHERE id = ?"};
+  static SQLite::Statement eraseTrusts{*landDB, "DELETE FROM trusts WHERE land = ?"};
+  static SQLite::Statement insertTile{
+      *landDB, "INSERT OR IGNORE INTO land_tiles (dim, tx, tz, id) VALUES (?, ?, ?, ?)"};
+  static SQLite::Statement eraseTiles{*landDB, "DELETE FROM land_tiles WHERE id = ?"};
+  static SQLite::Statement trust{*landDB, "INSERT OR IGNORE INTO trusts (land, xuid) VALUES (?, ?)"};
+  static SQLite::Statement untrust{*landDB, "DELETE FROM trusts WHERE land = ? AND xuid = ?"};
+  static SQLite::Statement renew{*landDB, "UPDATE lands SET paid_until = ? WHERE id = ?"};
+  static SQLite::Statement resize{
+      *landDB, "UPDATE lands SET x1 = ?, y1 = ?, z1 = ?, x2 = ?, y2 = ?, z2 = ?, chkx1 = ?, chky1 = ?, chkz1 = ?, "
+               "chkx2 = ?, chky2 = ?, chkz2 = ? WHERE id = ?"};
+
+  const LandRecord &land = mutation.land;
+
+  // One row per tile the land covers, or a single pinned one when it covers too many
+  auto storeTiles = [&] {
+    RegionCache::Span span = RegionCache::Tiles(land.box);
+    if (span.Pinned()) span = {RegionCache::kPinned, RegionCache::kPinned, RegionCache::kPinned, RegionCache::kPinned};
+
+    for (int32_t tx = span.X1; tx <= span.X2; tx++) {
+      for (int32_t tz = span.Z1; tz <= span.Z2; tz++) {
+        BOOST_SCOPE_EXIT_ALL() {
+          insertTile.clearBindings();
+          insertTile.tryReset();
+        };
+
+        insertTile.bind(1, land.dim);
+        insertTile.bind(2, tx);
+        insertTile.bind(3, tz);
+        insertTile.bind(4, land.id);
+        insertTile.exec();
+      }
+    }
+  };
+
+  switch (mutation.kind) {
+  case LandMutation::Kind::Insert: {
+    BOOST_SCOPE_EXIT_ALL() {
+      insert.clearBindings();
+      insert.tryReset();
+    };
+
+    Vector3 chunk1 = getChunk(Vector3(land.box.X1, land.box.Y1, land.box.Z1));
+    Vector3 chunk2 = getChunk(Vector3(land.box.X2, land.box.Y2, land.box.Z2));
+
+    insert.bind(1, land.id);
+    insert.bind(2, (int64_t) land.owner);
+    insert.bind(3, land.dim);
+    insert.bind(4, land.box.X1);
+    insert.bind(5, land.box.Y1);
+    insert.bind(6, land.box.Z1);
+    insert.bind(7, land.box.X2);
+    insert.bind(8, land.box.Y2);
+    insert.bind(9, land.box.Z2);
+    insert.bind(10, chunk1.X);
+    insert.bind(11, chunk1.Y);
+    insert.bind(12, chunk1.Z);
+    insert.bind(13, chunk2.X);
+    insert.bind(14, chunk2.Y);
+    insert.bind(15, chunk2.Z);
+    insert.bind(16, land.depth);
+    insert.exec();
+
+    storeTiles();
+  } break;
+
+  case LandMutation::Kind::Erase: {
+    BOOST_SCOPE_EXIT_ALL() {
+      erase.clearBindings();
+      erase.tryReset();
+      eraseTrusts.clearBindings();
+      eraseTrusts.tryReset();
+      eraseTiles.clearBindings();
+      eraseTiles.tryReset();
+    };
+
+    erase.bind(1, land.id);
+    erase.exec();
+    eraseTrusts.bind(1, land.id);
+    eraseTrusts.exec();
+    eraseTiles.bind(1, land.id);
+    eraseTiles.exec();
+  } break;
+
+  case LandMutation::Kind::SetOwner: {
+    BOOST_SCOPE_EXIT_ALL() {
+      setOwner.clearBindings();
+      setOwner.tryReset();
+    };
+
+    setOwner.bind(1, (int64_t) land.owner);
+    setOwner.bind(2, land.id);
+    setOwner.exec();
+  } break;
+
+  case LandMutation::Kind::Trust: {
+    BOOST_SCOPE_EXIT_ALL() {
+      trust.clearBindings();
+      trust.tryReset();
+    };
+
+    trust.bind(1, land.id);
+    trust.bind(2, (int64_t) mutation.player);
+    trust.exec();
+  } break;
+
+  case LandMutation::Kind::Untrust: {
+    BOOST_SCOPE_EXIT_ALL() {
+      untrust.clearBindings();
+      untrust.tryReset();
+    };
+
+    untrust.bind(1, land.id);
+    untrust.bind(2, (int64_t) mutation.player);
+    untrust.exec();
+  } break;
+
+  case LandMutation::Kind::Renew: {
+    BOOST_SCOPE_EXIT_ALL() {
+      renew.clearBindings();
+      renew.tryReset();
+    };
+
+    renew.bind(1, mutation.paidUntil);
+    renew.bind(2, land.id);
+    renew.exec();
+  } break;
+
+  // Owner, depth, claim date, rent deadline and trusted players stay as they are
+  case LandMutation::Kind::Resize: {
+    BOOST_SCOPE_EXIT_ALL() {
+      resize.clearBindings();
+      resize.tryReset();
+      eraseTiles.clearBindings();
+      eraseTiles.tryReset();
+    };
+
+    Vector3 chunk1 = getChunk(Vector3(land.box.X1, land.box.Y1, land.box.Z1));
+    Vector3 chunk2 = getChunk(Vector3(land.box.X2, land.box.Y2, land.box.Z2));
+
+    resize.bind(1, land.box.X1);
+    resize.bind(2, land.box.Y1);
+    resize.bind(3, land.box.Z1);
+    resize.bind(4, land.box.X2);
+    resize.bind(5, land.box.Y2);
+    resize.bind(6, land.box.Z2);
+    resize.bind(7, chunk1.X);
+    resize.bind(8, chunk1.Y);
+    resize.bind(9, chunk1.Z);
+    resize.bind(10, chunk2.X);
+    resize.bind(11, chunk2.Y);
+    resize.bind(12, chunk2.Z);
+    resize.bind(13, land.id);
+    if (!resize.exec()) break;
+
+    eraseTiles.bind(1, land.id);
+    eraseTiles.exec();
+    storeTiles();
+  } break;
+  }
+}
+
+// Commits a batch in a single transaction together with the last sequence number it contains
+void commitBatch(const std::vector<std::pair<uint64_t, LandMutation>> &batch) {
+  ScopedTimer timer(landStats[Probe::WriterCommit]);
+
+  static SQLite::Statement progress{*landDB, "INSERT OR REPLACE INTO meta (key, value) VALUES ('journal_seq', ?)"};
+  static SQLite::Statement dropSnapshot{*landDB, "DELETE FROM meta WHERE key = 'snapshot'"};
+
+  BOOST_SCOPE_EXIT_ALL() {
+    progress.clearBindings();
+    progress.tryReset();
+    dropSnapshot.tryReset();
+  };
+
+  SQLite::Transaction trans(*landDB);
+
+  for (auto &[seq, mutation] : batch) applyToDatabase(mutation);
+
+  progress.bind(1, (int64_t) batch.back().first);
+  progress.exec();
+
+  // Any snapshot on disk no longer matches the tables
+  dropSnapshot.exec();
+
+  trans.commit();
+}
+
+int journalDescriptor() {
+#if defined(_WIN32)
+  return _fileno(journal);
+#else
+  return fileno(journal);
+#endif
+}
+
+bool syncDescriptor(int fd) {
+#if defined(_WIN32)
+  return _commit(fd) == 0;
+#else
+  return fdatasync(fd) == 0;
+#endif
+}
+
+// Forces everything appended so far onto the disk
+bool syncJournal() { return std::fflush(journal) == 0 && syncDescriptor(journalDescriptor()); }
+
+std::string journalPath(int file) { return file ? settings.journal + ".1" : settings.journal; }
+
+// Runs the acknowledgements of everything up to seq, outside the journal lock
+void acknowledge(uint64_t seq) {
+  std::vector<std::function<void()>> ready;
+
+  {
+    std::lock_guard lock(journalMutex);
+
+    while (!acks.empty() && acks.front().first <= seq) {
+      ready.push_back(std::move(acks.front().second));
+      acks.pop_front();
+    }
+  }
+
+  for (auto &ack : ready) ack();
+}
+
+// The group commit: one sync for everything published since the last one. Only the writer thread switches or closes
+// the journal, so its descriptor stays valid without holding the lock through the sync.
+void syncPublished() {
+  uint64_t seq;
+  int fd = -1;
+
+  {
+    std::lock_guard lock(journalMutex);
+    if (syncedSeq == publishedSeq) return;
+
+    seq = publishedSeq;
+    if (journal) fd = journalDescriptor();
+  }
+
+  if (fd < 0 || !syncDescriptor(fd)) {
+    LOGE("[LM] Failed to sync the land journal, changes are only safe once the database has them");
+    return;
+  }
+
+  {
+    std::lock_guard lock(journalMutex);
+    syncedSeq = seq;
+  }
+
+  acknowledge(seq);
+}
+
+// Keeps a mutation that could not be stored next to the journal, in the same format, and moves the stored progress
+// past it so startup does not replay it again
+void setAside(uint64_t seq, const LandMutation &mutation, const char *error) {
+  static SQLite::Statement progress{*landDB, "INSERT OR REPLACE INTO meta (key, value) VALUES ('journal_seq', ?)"};
+
+  BOOST_SCOPE_EXIT_ALL() {
+    progress.clearBindings();
+    progress.tryReset();
+  };
+
+  std::string path  = settings.journal + ".failed";
+  JournalRecord rec = encode(seq, mutation);
+  bool kept         = false;
+
+  if (std::FILE *file = std::fopen(path.c_str(), "ab")) {
+    kept = std::fwrite(&rec, sizeof(rec), 1, file) == 1;
+    kept = std::fclose(file) == 0 && kept;
+  }
+
+  LOGE("[LM] Gave up saving change %d (kind %d) to land %d: %s. The index and the database now disagree, %s") % seq %
+      (int) mutation.kind % mutation.land.id % error %
+      (kept ? "the change was kept in " + path : std::string("the change could not be kept either"));
+  landStats[Probe::WriterCommit].Deny();
+
+  try {
+    progress.bind(1, (int64_t) seq);
+    progress.exec();
+  } catch (SQLite::Exception const &) {
+    // Replayed again at startup, which may well succeed once whatever failed is fixed
+  }
+}
+
+// A batch that keeps failing is stored one mutation at a time, whatever still fails is set aside
+void commitSeparately(const std::vector<std::pair<uint64_t, LandMutation>> &batch) {
+  for (auto &entry : batch) {
+    try {
+      commitBatch({entry});
+    } catch (SQLite::Exception const &ex) {
+      setAside(entry.first, entry.second, ex.what());
+    }
+  }
+}
+
+void truncateJournal() {
+  if (journal) std::fclose(journal);
+  journal      = std::fopen(journalPath(journalFile).c_str(), "wb");
+  journalBytes = 0;
+}
+
+// Starts the journal over once the writer caught up. Under steady writes it never does, so past kJournalLimit it
+// moves on to the other file instead, whose records are all committed by then.
+void trimJournal() {
+  if (committedSeq == publishedSeq) {
+    truncateJournal();
+    return;
+  }
+
+  if (journalBytes < kJournalLimit || retiredSeq > committedSeq) return;
+
+  // The tail appended since the last group commit is not synced yet, and after this nothing syncs this file again
+  if (journal && !syncJournal()) LOGE("[LM] Failed to sync the land journal before moving on from it");
+
+  syncedSeq   = publishedSeq;
+  retiredSeq  = publishedSeq;
+  journalFile = journalFile ^ 1;
+  truncateJournal();
+}
+
+void writerLoop() {
+  std::vector<std::pair<uint64_t, LandMutation>> batch;
+  int attempts = 0;
+
+  while (true) {
+    {
+      std::unique_lock lock(queueMutex);
+      queueCv.wait(lock, [] { return stopping || !queue.empty(); });
+
+      if (queue.empty()) break;
+
+      size_t count = std::min(queue.size(), kBatchSize);
+      batch.assign(queue.begin(), queue.begin() + count);
+    }
+
+    syncPublished();
+
+    try {
+      if (attempts < kMaxAttempts) {
+        commitBatch(batch);
+      } else {
+        commitSeparately(batch);
+      }
+    } catch (SQLite::Exception const &ex) {
+      LOGE("[LM] Failed to persist land changes, retrying: %s") % ex.what();
+      landStats[Probe::WriterCommit].Deny();
+      attempts++;
+
+      std::unique_lock lock(queueMutex);
+      if (stopping) break;
+
+      // Keep the batch at the head of the queue so ordering is preserved, the journal still holds it too
+      queueCv.wait_for(lock, std::chrono::seconds(1), [] { return stopping; });
+      continue;
+    }
+
+    attempts = 0;
+
+    {
+      std::lock_guard lock(queueMutex);
+      queue.erase(queue.begin(), queue.begin() + batch.size());
+      landStats.pendingWrites.store(queue.size(), std::memory_order_relaxed);
+
+      if (queue.empty()) {
+        ownerSeqs.clear();
+        unknownOwnerSeq = 0;
+      }
+    }
+
+    drainedCv.notify_all();
+
+    uint64_t durable;
+
+    {
+      std::lock_guard lock(journalMutex);
+      committedSeq = batch.back().first;
+      trimJournal();
+      durable = std::max(committedSeq, syncedSeq);
+    }
+
+    // Committed changes are durable even if syncing the journal failed
+    acknowledge(durable);
+  }
+}
+
+inline uint64_t tileKey(int dim, int32_t tx, int32_t tz) {
+  return (uint64_t) (uint32_t) dim << 48 ^ (uint64_t) (uint32_t) tx << 24 ^ (uint64_t) (uint32_t) tz;
+}
+
+// Renewals change nothing a page-in loads, so they are not kept
+void record(const LandMutation &mutation) {
+  if (mutation.kind == LandMutation::Kind::Renew) return;
+
+  uint32_t at = (uint32_t) recorded.size();
+  recorded.push_back(mutation);
+  recordedLands[mutation.land.id].push_back(at);
+
+  if (mutation.kind != LandMutation::Kind::Insert) return;
+
+  RegionCache::Span span = RegionCache::Tiles(mutation.land.box);
+  if (span.Pinned()) span = {RegionCache::kPinned, RegionCache::kPinned, RegionCache::kPinned, RegionCache::kPinned};
+
+  for (int32_t tx = span.X1; tx <= span.X2; tx++) {
+    for (int32_t tz = span.Z1; tz <= span.Z2; tz++) recordedTiles[tileKey(mutation.land.dim, tx, tz)].push_back(at);
+  }
+}
+
+// Inserts name their owner, the others are looked up before they are applied. Trusting and renewing change nothing a
+// listing shows.
+void fileUnderOwners(const LandMutation &mutation, uint64_t seq) {
+  switch (mutation.kind) {
+  case LandMutation::Kind::Insert: ownerSeqs[mutation.land.owner] = seq; break;
+
+  case LandMutation::Kind::SetOwner: ownerSeqs[mutation.land.owner] = seq; [[fallthrough]];
+  case LandMutation::Kind::Erase:
+  case LandMutation::Kind::Resize: {
+    auto land = landIndex.Read()->Find(mutation.land.id);
+
+    if (land) {
+      ownerSeqs[land->owner] = seq;
+    } else {
+      unknownOwnerSeq = seq;
+    }
+  } break;
+
+  default: break;
+  }
+}
+
+void stopRecording() {
+  recording = false;
+  recorded  = {};
+  recordedLands.clear();
+  recordedTiles.clear();
+}
+
+void publish(const std::vector<LandMutation> &mutations) {
+  if (mutations.empty()) return;
+
+  std::lock_guard lock(journalMutex);
+  uint64_t first = publishedSeq + 1;
+  bool written   = journal != nullptr;
+
+  for (const LandMutation &mutation : mutations) {
+    JournalRecord rec = encode(++publishedSeq, mutation);
+    if (written) written = std::fwrite(&rec, sizeof(rec), 1, journal) == 1;
+  }
+
+  // Handed to the OS so a crash of the server alone loses nothing, the writer syncs it with the next batch. It still
+  // stores the group if the journal could not.
+  if (written && std::fflush(journal) == 0) {
+    journalBytes += mutations.size() * sizeof(JournalRecord);
+  } else {
+    LOGE("[LM] Failed to append to the land journal");
+  }
+
+  std::lock_guard queueLock(queueMutex);
+  uint64_t seq = first;
+
+  for (const LandMutation &mutation : mutations) {
+    fileUnderOwners(mutation, seq);
+    landIndex.Apply(mutation);
+    rents.Apply(mutation);
+    queue.emplace_back(seq++, mutation);
+
+    if (recording) record(mutation);
+  }
+
+  if (recording && recorded.size() > kMaxRecorded) stopRecording();
+
+  landStats.pendingWrites.store(queue.size(), std::memory_order_relaxed);
+  queueCv.notify_one();
+}
+
+} // namespace
+
+// Replays whatever the previous run journaled but never committed, must run after migrations and before the index
+// is loaded
+void LandManager::RecoverJournal() {
+  SQLite::Statement stmt{*landDB, "SELECT value FROM meta WHERE key = 'journal_seq'"};
+  committedSeq = stmt.executeStep() ? stmt.getColumn(0).getInt64() : 0;
+
+  std::vector<std::pair<uint64_t, LandMutation>> pending;
+
+  for (int file = 0; file < 2; file++) {
+    std::FILE *in = std::fopen(journalPath(file).c_str(), "rb");
+    if (!in) continue;
+
+    JournalRecord rec;
+
+    // A torn or corrupt record ends its file
+    while (std::fread(&rec, sizeof(rec), 1, in) == 1 && rec.checksum == checksum(rec)) {
+      if (rec.seq > committedSeq) pending.emplace_back(rec.seq, decode(rec));
+    }
+
+    std::fclose(in);
+  }
+
+  std::sort(pending.begin(), pending.end(), [](auto &a, auto &b) { return a.first < b.first; });
+
+  // Nothing after a missing sequence number can have been published in order
+  for (size_t i = 0; i < pending.size(); i++) {
+    if (pending[i].first == committedSeq + 1 + i) continue;
+
+    LOGW("[LM] The land journal breaks off at change %d, dropping %d changes after it") % (committedSeq + 1 + i) %
+        (pending.size() - i);
+    pending.resize(i);
+  }
+
+  if (!pending.empty()) {
+    LOGW("[LM] Replaying %d uncommitted land changes") % pending.size();
+    commitBatch(pending);
+    committedSeq = pending.back().first;
+  }
+
+  publishedSeq = committedSeq;
+  syncedSeq    = committedSeq;
+  retiredSeq   = 0;
+  journalFile  = 1;
+  truncateJournal();
+  journalFile = 0;
+  truncateJournal();
+
+  SQLite::Statement maxId{*landDB, "SELECT IFNULL(MAX(id), 0) FROM lands"};
+  nextLandId = maxId.executeStep() ? maxId.getColumn(0).getInt64() + 1 : 1;
+}
+
+void LandManager::StartWriter() {
+  {
+    std::lock_guard lock(journalMutex);
+    acking = true;
+  }
+
+  stopping = false;
+  writer   = std::thread(writerLoop);
+}
+
+bool LandManager::FlushDatabase() {
+  // Page-ins read the database as well, lookups only see what is resident from here on
+  regions.Stop();
+
+  {
+    std::lock_guard lock(queueMutex);
+    stopping = true;
+  }
+
+  queueCv.notify_one();
+  if (writer.joinable()) writer.join();
+
+  std::unique_lock lock(journalMutex);
+  bool saved = committedSeq == publishedSeq;
+
+  if (!saved) LOGE("[LM] Some land changes were not saved, they will be replayed on startup");
+  if (journal && !saved && !syncJournal()) LOGE("[LM] Failed to sync the land journal");
+  if (journal) std::fclose(journal);
+  journal = nullptr;
+
+  // Nothing syncs after this, whoever still waits is told now
+  auto pending = std::move(acks);
+  acks.clear();
+  acking = false;
+  lock.unlock();
+
+  for (auto &[seq, ack] : pending) ack();
+  return saved;
+}
+
+// Runs ack once everything published so far is on disk, in the journal or in the database. That happens on the
+// writer thread, or right away when it already is.
+void LandManager::OnDurable(std::function<void()> ack) {
+  std::unique_lock lock(journalMutex);
+  uint64_t seq = publishedSeq;
+
+  if (acking && seq > syncedSeq && seq > committedSeq) {
+    acks.emplace_back(seq, std::move(ack));
+    return;
+  }
+
+  lock.unlock();
+  ack();
+}
+
+// Blocks until at most pending mutations are left for the writer, false if that took longer than the timeout
+bool LandManager::WaitForWriter(size_t pending, std::chrono::milliseconds timeout) {
+  std::unique_lock lock(queueMutex);
+  return drainedCv.wait_for(lock, timeout, [&] { return queue.size() <= pending; });
+}
+
+bool LandManager::WaitForOwner(uint64_t owner, std::chrono::milliseconds timeout) {
+  std::unique_lock lock(queueMutex);
+
+  auto it      = ownerSeqs.find(owner);
+  uint64_t seq = std::max(it == ownerSeqs.end() ? 0 : it->second, unknownOwnerSeq);
+
+  return drainedCv.wait_for(lock, timeout, [&] { return queue.empty() || queue.front().first > seq; });
+}
+
+int64_t LandManager::NextLandId() { return nextLandId++; }
+
+// Oldest first, the database may or may not hold any of them yet
+std::vector<LandMutation> LandManager::PendingMutations() {
+  std::lock_guard lock(queueMutex);
+  std::vector<LandMutation> pending;
+
+  pending.reserve(queue.size());
+  for (auto &[seq, mutation] : queue) pending.push_back(mutation);
+
+  return pending;
+}
+
+void LandManager::StartRecording() {
+  std::lock_guard lock(queueMutex);
+  stopRecording();
+  recording = true;
+}
+
+// Mutations published since StartRecording to one of the lands or to a land inserted under the tile since, oldest
+// first. More than max means replaying would cost more than reading the tile from the database, only max + 1 are
+// returned then. False once too many were published to keep them all.
+bool LandManager::RecordedMutations(
+    int dim, int32_t tx, int32_t tz, const std::vector<int64_t> &ids, size_t max, std::vector<LandMutation> &out) {
+  std::lock_guard lock(queueMutex);
+  if (!recording) return false;
+
+  std::vector<uint32_t> found;
+
+  auto add = [&](int64_t id) {
+    auto it = recordedLands.find(id);
+    if (it != recordedLands.end()) found.insert(found.end(), it->second.begin(), it->second.end());
+    return found.size() <= max;
+  };
+
+  bool within = true;
+
+  for (size_t i = 0; i < ids.size() && within; i++) within = add(ids[i]);
+
+  auto tile = recordedTiles.find(tileKey(dim, tx, tz));
+
+  if (tile != recordedTiles.end()) {
+    for (size_t i = 0; i < tile->second.size() && within; i++) within = add(recorded[tile->second[i]].land.id);
+  }
+
+  // A land inserted more than once since startup is found once per insert
+  std::sort(found.begin(), found.end());
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+
+  out.clear();
+  out.reserve(std::min(found.size(), max + 1));
+
+  for (size_t i = 0; i < found.size() && i <= max; i++) out.push_back(recorded[found[i]]);
+  return true;
+}
+
+void LandManager::Submit(const LandMutation &mutation) {
+  if (current) {
+    current->staged.push_back(mutation);
+    return;
+  }
+
+  publish({mutation});
+}
+
+LandManager::Transaction::Transaction() : outer(current) { current = this; }
+
+LandManager::Transaction::~Transaction() {
+  // Anything still staged was never committed and is simply dropped
+  if (current == this) current = outer;
+}
+
+void LandManager::Transaction::Commit() {
+  current = outer;
+
+  // A nested transaction only becomes visible once the outermost one commits
+  if (outer) {
+    outer->staged.insert(outer->staged.end(), staged.begin(), staged.end());
+  } else {
+    publish(staged);
+  }
+
+  staged.clear();
+}
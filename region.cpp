@@ -0,0 +1,334 @@
+#include "region.h"
+
+#include <algorithm>
+
+#include "stats.h"
+
+extern SharedLandIndex landIndex;
+
+namespace {
+
+// A tile read while more lands changed than the index keeps is read again, one that still cannot be is left out and
+// the lookup that wanted it only sees what is resident
+constexpr int kMaxAttempts = 4;
+
+// Applies to lands read from storage the mutations published while they were read
+void replay(const std::vector<LandMutation> &missed, std::vector<PagedLand> &paged) {
+  for (const LandMutation &mutation : missed) {
+    auto page = std::find_if(
+        paged.begin(), paged.end(), [&](const PagedLand &page) { return page.land.id == mutation.land.id; });
+    if (page == paged.end()) continue;
+
+    TrustSet &trusted = page->trusted;
+
+    switch (mutation.kind) {
+    case LandMutation::Kind::Insert:
+      page->land = mutation.land;
+      trusted.clear();
+      break;
+    case LandMutation::Kind::Erase: paged.erase(page); break;
+    case LandMutation::Kind::SetOwner: page->land.owner = mutation.land.owner; break;
+    case LandMutation::Kind::Trust:
+      if (std::find(trusted.begin(), trusted.end(), mutation.player) == trusted.end()) {
+        trusted.push_back(mutation.player);
+      }
+      break;
+    case LandMutation::Kind::Untrust:
+      trusted.erase(std::remove(trusted.begin(), trusted.end(), mutation.player), trusted.end());
+      break;
+    case LandMutation::Kind::Renew: break;
+    case LandMutation::Kind::Resize: page->land.box = mutation.land.box; break;
+    }
+  }
+}
+
+// First and last block of a tile along one axis. Chunk 0 spans blocks -15 to 15, so every tile is 512 blocks wide
+// except the one starting at chunk 0, which has 15 more.
+void tileBlocks(int32_t tile, int &first, int &last) {
+  int64_t chunk1 = (int64_t) tile << RegionCache::kTileShift;
+  int64_t chunk2 = chunk1 + (1 << RegionCache::kTileShift) - 1;
+  int64_t from   = chunk1 > 0 ? chunk1 * 16 : chunk1 * 16 - 15;
+  int64_t to     = chunk2 >= 0 ? chunk2 * 16 + 15 : chunk2 * 16;
+
+  first = (int) std::max<int64_t>(from, INT32_MIN);
+  last  = (int) std::min<int64_t>(to, INT32_MAX);
+}
+
+} // namespace
+
+LandBox RegionCache::Bounds(int32_t tx, int32_t tz) {
+  LandBox box;
+  box.Y1 = INT32_MIN;
+  box.Y2 = INT32_MAX;
+  tileBlocks(tx, box.X1, box.X2);
+  tileBlocks(tz, box.Z1, box.Z2);
+
+  return box;
+}
+
+bool RegionCache::Stored(const LandBox &box, int32_t tx, int32_t tz) {
+  Span span = Tiles(box);
+
+  if (span.Pinned()) return tx == kPinned && tz == kPinned;
+  return span.Contains(tx, tz);
+}
+
+void RegionCache::Start(Loader loader, int64_t budgetBytes) {
+  Stop();
+
+  this->loader = std::move(loader);
+  budget       = budgetBytes;
+  tiles.clear();
+  resident.store(0);
+
+  if (!this->loader) return;
+
+  for (int dim = 0; dim < LandIndex::kDimensions; dim++) pageIn(dim, kPinned, kPinned);
+
+  stopping = false;
+  paging.store(true);
+  pager = std::thread([this] { pagerLoop(); });
+}
+
+void RegionCache::Stop() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+    paging.store(false);
+  }
+
+  wake.notify_all();
+  served.notify_all();
+
+  if (pager.joinable()) pager.join();
+}
+
+SharedLandIndex::Reader RegionCache::Read(int dim, const LandBox &box) {
+  {
+    auto index = landIndex.Read();
+    if (!paging.load() || dim < 0 || dim >= LandIndex::kDimensions || holds(*index, dim, box)) return index;
+  }
+
+  std::optional<SharedLandIndex::Reader> answer;
+  request(dim, box, answer);
+
+  // Only left without an answer once paging stopped, nothing is paged in or out anymore then
+  if (answer) return std::move(*answer);
+  return landIndex.Read();
+}
+
+// Stamps are only stored when they change, readers on other cores keep sharing the cache line otherwise
+bool RegionCache::holds(const LandIndex &index, int dim, const LandBox &box) {
+  Span span    = Tiles(box);
+  uint64_t now = clock.load(std::memory_order_relaxed);
+
+  for (int32_t tx = span.X1; tx <= span.X2; tx++) {
+    for (int32_t tz = span.Z1; tz <= span.Z2; tz++) {
+      uint64_t tile = key(dim, tx, tz);
+      if (!index.Holds(tile)) return false;
+
+      std::atomic<uint64_t> &used = stamp(tile);
+      if (used.load(std::memory_order_relaxed) != now) used.store(now, std::memory_order_relaxed);
+    }
+  }
+
+  return true;
+}
+
+// Returns once the pager has served the batch holding the request, with the answer it left. The tiles around the box
+// are asked for too, a player who missed one tile is about to walk into the next.
+void RegionCache::request(int dim, const LandBox &box, std::optional<SharedLandIndex::Reader> &answer) {
+  std::unique_lock lock(mutex);
+  if (!paging.load()) return;
+
+  Span span      = Tiles(box);
+  LandBox first  = Bounds(span.X1 - 1, span.Z1 - 1);
+  LandBox last   = Bounds(span.X2 + 1, span.Z2 + 1);
+  LandBox around = LandBox(first.X1, box.Y1, first.Z1, last.X2, box.Y2, last.Z2);
+
+  requests.push_back(Request{dim, box, &answer});
+  if (!span.Pinned() && !Tiles(around).Pinned()) requests.push_back(Request{dim, around, nullptr});
+
+  uint64_t ticket = ++requested;
+
+  wake.notify_one();
+  served.wait(lock, [&] { return done >= ticket || !paging.load(); });
+}
+
+// Lookups waiting on a batch are answered with readers taken after their tiles are in, the pager's next write waits
+// for those to be released so nothing they need is evicted under them. Only then are tiles loaded ahead, and that
+// gives way as soon as another lookup misses.
+void RegionCache::pagerLoop() {
+  std::unique_lock lock(mutex);
+  std::vector<Request> batch;
+
+  for (;;) {
+    wake.wait(lock, [&] { return stopping || !requests.empty(); });
+    if (stopping) return;
+
+    batch.swap(requests);
+    uint64_t ticket = requested;
+    lock.unlock();
+
+    uint64_t now = clock.fetch_add(1) + 1;
+    bool paged   = false;
+
+    for (const Request &req : batch) {
+      if (req.answer) paged = serve(req, now, false) || paged;
+    }
+
+    if (paged) evict(now);
+
+    // A lookup that gave up because paging stopped has no answer to fill in anymore
+    lock.lock();
+    if (stopping) return;
+
+    for (const Request &req : batch) {
+      if (req.answer) req.answer->emplace(landIndex.Read());
+    }
+
+    done = ticket;
+    served.notify_all();
+    lock.unlock();
+
+    paged = false;
+
+    for (const Request &req : batch) {
+      if (req.answer) continue;
+
+      bool missed;
+
+      {
+        std::lock_guard check(mutex);
+        missed = stopping || requested != done;
+      }
+
+      if (missed) break;
+      paged = serve(req, now, true) || paged;
+    }
+
+    if (paged) evict(now);
+
+    batch.clear();
+    lock.lock();
+  }
+}
+
+// Pages in the tiles of a request that are not resident yet, true if there were any. A lookup marks every tile it
+// uses as used now, tiles loaded ahead are only marked as recent as the batch before, so a lookup's tiles still win.
+bool RegionCache::serve(const Request &req, uint64_t now, bool ahead) {
+  Span span  = Tiles(req.box);
+  bool paged = false;
+
+  for (int32_t tx = span.X1; tx <= span.X2; tx++) {
+    for (int32_t tz = span.Z1; tz <= span.Z2; tz++) {
+      uint64_t tile = key(req.dim, tx, tz);
+      bool loaded   = tiles.count(tile) != 0;
+
+      if (loaded && ahead) continue;
+      stamp(tile).store(ahead ? now - 1 : now, std::memory_order_relaxed);
+
+      if (loaded || !pageIn(req.dim, tx, tz)) continue;
+
+      tiles.emplace(tile, Slot{req.dim, tx, tz});
+      paged = true;
+    }
+  }
+
+  resident.store(tiles.size(), std::memory_order_relaxed);
+  return paged;
+}
+
+// Both copies of the index hold every land, tiles used since this batch started are never the oldest
+void RegionCache::evict(uint64_t now) {
+  if (budget <= 0) return;
+
+  while (residentBytes() > budget && evictOldest(now)) {}
+  resident.store(tiles.size(), std::memory_order_relaxed);
+}
+
+// Evicting writes to the index, so the reader has to be gone before that
+int64_t RegionCache::residentBytes() { return (int64_t) landIndex.Read()->Bytes() * 2; }
+
+// The database may be a little behind the index, lands already resident are newer than what was read. Mutations
+// published while the tile was being read are replayed on what was read, lands they inserted are in the index
+// already. The tile is only read again when more of them came in than the index keeps.
+bool RegionCache::pageIn(int dim, int32_t tx, int32_t tz) {
+  ScopedTimer timer(landStats[Probe::PageIn]);
+  std::vector<PagedLand> paged;
+  std::vector<LandMutation> missed;
+
+  for (int attempt = 0; attempt < kMaxAttempts; attempt++) {
+    uint64_t since = landIndex.Read()->Changes();
+    bool current   = false;
+
+    paged.clear();
+    loader(dim, tx, tz, paged);
+    landStats.pagedTiles.fetch_add(1, std::memory_order_relaxed);
+
+    // Both copies went through the same mutations, the second call finds nothing left to replay
+    landIndex.Write([&](LandIndex &index) {
+      if (index.Changes() != since) {
+        if (!index.ChangesSince(since, missed)) return;
+
+        replay(missed, paged);
+        since = index.Changes();
+      }
+
+      current = true;
+
+      for (const PagedLand &page : paged) {
+        if (!index.Find(page.land.id)) index.Page(page.land, page.trusted);
+      }
+
+      // Pinned lands stay for good and need no mark, kPinned would alias tile 0 in the key anyway
+      if (tx != kPinned) index.Hold(key(dim, tx, tz), true);
+    });
+
+    if (current) return true;
+  }
+
+  return false;
+}
+
+bool RegionCache::evictOldest(uint64_t now) {
+  auto oldest = tiles.end();
+
+  for (auto it = tiles.begin(); it != tiles.end(); it++) {
+    uint64_t used = stamp(it->first).load(std::memory_order_relaxed);
+    if (used < now && (oldest == tiles.end() || used < stamp(oldest->first).load(std::memory_order_relaxed))) {
+      oldest = it;
+    }
+  }
+
+  if (oldest == tiles.end()) return false;
+
+  uint64_t evicted = oldest->first;
+  Slot tile        = oldest->second;
+  tiles.erase(oldest);
+  landStats.evictedTiles.fetch_add(1, std::memory_order_relaxed);
+
+  std::vector<int64_t> dropped;
+
+  landIndex.Read()->Overlapping(tile.dim, Bounds(tile.x, tile.z), [&](const LandRecord &land) {
+    Span span = Tiles(land.box);
+    if (span.Pinned()) return true;
+
+    // Lands reaching into another resident tile stay, that tile would be missing them otherwise
+    for (int32_t tx = span.X1; tx <= span.X2; tx++) {
+      for (int32_t tz = span.Z1; tz <= span.Z2; tz++) {
+        if (tiles.count(key(tile.dim, tx, tz))) return true;
+      }
+    }
+
+    dropped.push_back(land.id);
+    return true;
+  });
+
+  landIndex.Write([&](LandIndex &index) {
+    index.Hold(evicted, false);
+    for (int64_t id : dropped) index.Evict(id);
+  });
+
+  return true;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "landindex.h"
+#include "sharedindex.h"
+
+// A stored land together with the players trusted on it
+struct PagedLand {
+  LandRecord land;
+  TrustSet trusted;
+};
+
+// Decides which lands are resident in the index, one tile at a time.
+//
+// Tiles are 32x32 chunks of one dimension, numbered from the same chunk coordinates getChunk gives. The first lookup
+// touching a tile loads every land stored under it, and once the index outgrows the memory budget the least recently
+// used tiles are dropped, along with the lands no other resident tile still needs. Lands spanning more than kMaxTiles
+// tiles are stored once under the pinned tile instead, loaded at startup and never dropped. Until a loader is set
+// every land is expected to be resident already and lookups never page.
+//
+// Lookups never write to the index themselves. Each copy of the index records the tiles it holds in full, a lookup
+// whose tiles are all there only reads, from any thread and without a lock. One that misses asks the pager thread for
+// the tiles and waits for a single batch, that thread is the only one paging lands in and evicting them. It answers
+// the lookup with a reader taken once its tiles are in, which keeps them from being evicted until the lookup is done,
+// and then loads the tiles around the miss ahead of the next lookups.
+class RegionCache {
+public:
+  static constexpr int kTileShift  = 5;
+  static constexpr int kMaxTiles   = 64;
+  static constexpr int32_t kPinned = INT32_MIN;
+
+  // Adds to out every land stored under the tile, kPinned/kPinned asks for the pinned ones
+  using Loader = std::function<void(int dim, int32_t tx, int32_t tz, std::vector<PagedLand> &out)>;
+
+  // Tiles a box covers, both corners included
+  struct Span {
+    int32_t X1, Z1, X2, Z2;
+
+    inline int64_t Count() const { return ((int64_t) X2 - X1 + 1) * ((int64_t) Z2 - Z1 + 1); }
+    inline bool Pinned() const { return Count() > kMaxTiles; }
+    inline bool Contains(int32_t tx, int32_t tz) const { return tx >= X1 && tx <= X2 && tz >= Z1 && tz <= Z2; }
+  };
+
+  // Chunks round toward zero like getChunk, so the tiles around the origin are a little wider
+  static inline int32_t Tile(int block) { return (block / 16) >> kTileShift; }
+  static inline Span Tiles(const LandBox &box) { return Span{Tile(box.X1), Tile(box.Z1), Tile(box.X2), Tile(box.Z2)}; }
+
+  // Every block of the tile, at any height
+  static LandBox Bounds(int32_t tx, int32_t tz);
+
+  // True if a land with these bounds is stored under the tile
+  static bool Stored(const LandBox &box, int32_t tx, int32_t tz);
+
+  RegionCache() = default;
+  RegionCache(const RegionCache &) = delete;
+  RegionCache &operator=(const RegionCache &) = delete;
+  inline ~RegionCache() { Stop(); }
+
+  // Forgets every resident tile, loads the pinned lands and starts the pager, the index must have been cleared. An
+  // empty loader turns paging off again.
+  void Start(Loader loader, int64_t budgetBytes);
+
+  // Stops the pager and turns paging off, lookups from then on only see the lands already resident
+  void Stop();
+
+  // A reader on a copy of the index holding every land the box touches. A miss waits for one batch of the pager,
+  // which waits for readers to drain before it writes, so the calling thread must not hold another reader.
+  SharedLandIndex::Reader Read(int dim, const LandBox &box);
+  inline SharedLandIndex::Reader Read(int dim, int x, int y, int z) { return Read(dim, LandBox(x, y, z, x, y, z)); }
+
+  // Waits until every tile the box covers is resident
+  inline void Ensure(int dim, const LandBox &box) { Read(dim, box); }
+  inline void Ensure(int dim, int x, int y, int z) { Ensure(dim, LandBox(x, y, z, x, y, z)); }
+
+  inline size_t Resident() const { return resident.load(std::memory_order_relaxed); }
+
+private:
+  // Lookups stamp the tiles they use with the pager's clock, in slots shared by tiles that hash alike. A shared slot
+  // only makes a tile look more recent than it is.
+  static constexpr int kStampBits = 12;
+
+  // Lookups waiting on the pager get their answer, tiles asked for ahead of time have none
+  struct Request {
+    int dim;
+    LandBox box;
+    std::optional<SharedLandIndex::Reader> *answer;
+  };
+
+  struct Slot {
+    int dim;
+    int32_t x, z;
+  };
+
+  static inline uint64_t key(int dim, int32_t tx, int32_t tz) {
+    return (uint64_t) dim << 48 | (uint64_t) (tx & 0xFFFFFF) << 24 | (uint64_t) (tz & 0xFFFFFF);
+  }
+
+  inline std::atomic<uint64_t> &stamp(uint64_t tile) {
+    return stamps[(tile * 0x9E3779B97F4A7C15ull) >> (64 - kStampBits)];
+  }
+
+  static int64_t residentBytes();
+  bool holds(const LandIndex &index, int dim, const LandBox &box);
+  void request(int dim, const LandBox &box, std::optional<SharedLandIndex::Reader> &answer);
+  void pagerLoop();
+  bool serve(const Request &req, uint64_t now, bool ahead);
+  void evict(uint64_t now);
+  bool pageIn(int dim, int32_t tx, int32_t tz);
+  bool evictOldest(uint64_t now);
+
+  // Owned by the pager thread once it runs
+  Loader loader;
+  int64_t budget = 0;
+  std::unordered_map<uint64_t, Slot> tiles;
+
+  std::atomic<bool> paging{false};
+  std::atomic<uint64_t> clock{0};
+  std::atomic<size_t> resident{0};
+  std::atomic<uint64_t> stamps[1 << kStampBits] = {};
+
+  // Misses only, a lookup that finds its tiles never touches these
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable served;
+  std::vector<Request> requests;
+  uint64_t requested = 0;
+  uint64_t done      = 0;
+  bool stopping      = false;
+  std::thread pager;
+};
+
+extern RegionCache regions;
@@ -0,0 +1,125 @@
+#include "rent.h"
+
+#include <chrono>
+
+#include "database.h"
+
+DEF_LOGGER("LandManager");
+
+int64_t RentBook::Now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void RentBook::Load() {
+  std::lock_guard lock(mutex);
+  int64_t now = Now();
+
+  interval = settings.rentInterval > 0 ? settings.rentInterval : 0;
+  leases.clear();
+  ready.clear();
+  wheel.Reset(now);
+
+  if (!interval) return;
+
+  SQLite::Statement stmt{
+      *landDB, "SELECT id, owner, (x2 - x1 + 1) * (y2 - y1 + 1) * (z2 - z1 + 1), paid_until, "
+               "IFNULL(CAST(STRFTIME('%s', created_at) AS INTEGER), ?) FROM lands"};
+  stmt.bind(1, now);
+
+  while (stmt.executeStep()) {
+    int64_t id   = stmt.getColumn(0).getInt64();
+    Lease &lease = leases[id];
+
+    lease.owner     = stmt.getColumn(1).getInt64();
+    lease.volume    = stmt.getColumn(2).getInt64();
+    lease.paidUntil = stmt.getColumn(3).getInt64();
+    if (!lease.paidUntil) lease.paidUntil = stmt.getColumn(4).getInt64() + interval;
+
+    schedule(id, lease, lease.paidUntil);
+  }
+
+  LOGI("[LM] Loaded rent deadlines for %d lands") % leases.size();
+}
+
+void RentBook::Apply(const LandMutation &mutation) {
+  std::lock_guard lock(mutex);
+  if (!interval) return;
+
+  const LandRecord &land = mutation.land;
+
+  switch (mutation.kind) {
+  case LandMutation::Kind::Insert: {
+    Lease &lease    = leases[land.id];
+    lease.owner     = land.owner;
+    lease.volume    = land.box.Volume();
+    lease.paidUntil = Now() + interval;
+
+    schedule(land.id, lease, lease.paidUntil);
+  } break;
+
+  case LandMutation::Kind::Erase: leases.erase(land.id); break;
+
+  case LandMutation::Kind::SetOwner: {
+    auto it = leases.find(land.id);
+    if (it != leases.end()) it->second.owner = land.owner;
+  } break;
+
+  case LandMutation::Kind::Resize: {
+    auto it = leases.find(land.id);
+    if (it != leases.end()) it->second.volume = land.box.Volume();
+  } break;
+
+  case LandMutation::Kind::Renew: {
+    auto it = leases.find(land.id);
+    if (it == leases.end()) break;
+
+    it->second.paidUntil = mutation.paidUntil;
+    schedule(land.id, it->second, it->second.paidUntil);
+  } break;
+
+  default: break;
+  }
+}
+
+bool RentBook::TickDue(int64_t now) {
+  if (!interval) return false;
+
+  int64_t last = lastTick.load(std::memory_order_relaxed);
+  return now > last && lastTick.compare_exchange_strong(last, now, std::memory_order_relaxed);
+}
+
+// Every land handed out must be renewed, erased or retried, until then nothing else takes it off the wheel
+void RentBook::Collect(int64_t now, size_t max, std::vector<RentDue> &out) {
+  std::lock_guard lock(mutex);
+
+  wheel.Advance(now, [&](int64_t id, int64_t deadline) {
+    auto it = leases.find(id);
+    if (it == leases.end() || it->second.deadline != deadline) return;
+
+    it->second.deadline = kQueued;
+    ready.push_back(id);
+  });
+
+  while (out.size() < max && !ready.empty()) {
+    int64_t id = ready.front();
+    ready.pop_front();
+
+    // Sold or renewed since it was queued
+    auto it = leases.find(id);
+    if (it == leases.end() || it->second.deadline != kQueued) continue;
+
+    out.push_back({id, it->second.owner, it->second.volume, it->second.paidUntil});
+  }
+}
+
+void RentBook::Retry(int64_t id, int64_t at) {
+  std::lock_guard lock(mutex);
+
+  auto it = leases.find(id);
+  if (it != leases.end()) schedule(id, it->second, at);
+}
+
+void RentBook::schedule(int64_t id, Lease &lease, int64_t deadline) {
+  lease.deadline = deadline;
+  wheel.Schedule(id, deadline);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "landindex.h"
+#include "timerwheel.h"
+
+// A land whose rent came due, as it stood when it was taken off the wheel
+struct RentDue {
+  int64_t id;
+  uint64_t owner;
+  int64_t volume;
+  int64_t paidUntil;
+};
+
+// Rent and expiry deadlines of every land, resident or not.
+//
+// Each land is paid up to some time in unix seconds and the next interval is due then. Deadlines sit in a timer wheel,
+// so a tick only touches the lands due in it no matter how many there are. Published mutations keep the book in step
+// with the lands table, at startup it is read back in one pass. Taking money and reclaiming lands is left to the
+// caller, which renews what was paid with a Renew mutation and retries the rest later.
+class RentBook {
+public:
+  // Seconds before a land that could not be paid for is looked at again
+  static constexpr int64_t kRetry = 600;
+
+  static int64_t Now();
+
+  // Lands never paid for are paid up to one interval after they were claimed. Does nothing while rent is disabled.
+  void Load();
+  void Apply(const LandMutation &mutation);
+
+  // True at most once a second while rent is enabled, for whoever gets there first
+  bool TickDue(int64_t now);
+
+  // Up to max lands due by now, any more stay queued for the next tick
+  void Collect(int64_t now, size_t max, std::vector<RentDue> &out);
+
+  // Looks at a land again at the given time without changing what it paid
+  void Retry(int64_t id, int64_t at);
+
+  inline size_t Size() const { return leases.size(); }
+
+private:
+  // Deadline of a land already taken off the wheel and waiting to be collected
+  static constexpr int64_t kQueued = -1;
+
+  struct Lease {
+    uint64_t owner;
+    int64_t volume;
+    int64_t paidUntil;
+
+    // Next time the land is looked at, a timer for any other time is stale
+    int64_t deadline;
+  };
+
+  void schedule(int64_t id, Lease &lease, int64_t deadline);
+
+  std::mutex mutex;
+  int64_t interval = 0;
+  std::unordered_map<int64_t, Lease> leases;
+  TimerWheel wheel;
+  std::deque<int64_t> ready;
+  std::atomic<int64_t> lastTick{0};
+};
+
+inline RentBook rents;
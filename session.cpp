@@ -0,0 +1,89 @@
+#include "session.h"
+
+#include <chrono>
+#include <utility>
+
+int32_t SessionTable::now() {
+  auto uptime = std::chrono::steady_clock::now().time_since_epoch();
+  return (int32_t) std::chrono::duration_cast<std::chrono::seconds>(uptime).count();
+}
+
+size_t SessionTable::find(uint64_t xuid) const {
+  for (size_t i = home(xuid);; i = (i + 1) & (kCapacity - 1)) {
+    if (slots[i].xuid == xuid) return i;
+    if (slots[i].xuid == 0) return kCapacity;
+  }
+}
+
+bool SessionTable::expired(const Session &session, int32_t time) const {
+  return settings.sessionTimeout > 0 && time - session.lastSeen > settings.sessionTimeout;
+}
+
+// Backward shift deletion, later entries of the chain move up so lookups never need tombstones
+void SessionTable::erase(size_t i) {
+  size_t hole = i;
+
+  for (size_t j = (i + 1) & (kCapacity - 1); slots[j].xuid != 0; j = (j + 1) & (kCapacity - 1)) {
+    size_t wanted = home(slots[j].xuid);
+
+    // Entries already sitting between their home slot and the hole stay where they are
+    bool between = hole <= j ? (wanted > hole && wanted <= j) : (wanted > hole || wanted <= j);
+    if (between) continue;
+
+    slots[hole] = std::move(slots[j]);
+    hole        = j;
+  }
+
+  slots[hole] = Session();
+  size--;
+}
+
+void SessionTable::evictIdle() {
+  int32_t time = now();
+
+  // Erasing shifts entries backwards, so the current slot is checked again before moving on
+  for (size_t i = 0; i < kCapacity;) {
+    if (slots[i].xuid != 0 && expired(slots[i], time)) {
+      erase(i);
+    } else {
+      i++;
+    }
+  }
+}
+
+Session *SessionTable::Find(uint64_t xuid) {
+  size_t i = find(xuid);
+  if (i == kCapacity) return nullptr;
+
+  int32_t time = now();
+
+  if (expired(slots[i], time)) {
+    erase(i);
+    return nullptr;
+  }
+
+  slots[i].lastSeen = time;
+  return &slots[i];
+}
+
+Session *SessionTable::Open(uint64_t xuid) {
+  if (Session *session = Find(xuid)) return session;
+
+  if (size >= kMaxSessions) evictIdle();
+  if (size >= kMaxSessions) return nullptr;
+
+  size_t i = home(xuid);
+  while (slots[i].xuid != 0) i = (i + 1) & (kCapacity - 1);
+
+  slots[i]          = Session();
+  slots[i].xuid     = xuid;
+  slots[i].lastSeen = now();
+  size++;
+
+  return &slots[i];
+}
+
+void SessionTable::Close(uint64_t xuid) {
+  size_t i = find(xuid);
+  if (i != kCapacity) erase(i);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "settings.h"
+
+// The selection last previewed to a player and every land that cut into it or held it then. Still current while the
+// index has had no mutation since, so the next preview only looks up the part of its selection that is new. Kept in
+// place like the rest of the session, a selection touching more lands than fit is looked up whole every time.
+struct SelectionPreview {
+  static constexpr size_t kMaxTouching = 8;
+
+  bool valid       = false;
+  int32_t dim      = 0;
+  uint64_t changes = 0;
+  LandBox box;
+
+  // False once the lands touching the selection did not fit
+  bool complete  = false;
+  uint32_t count = 0;
+  LandRecord touching[kMaxTouching];
+};
+
+// The page of owned lands last listed to a player, by the ids it started and ended at. Pages next to it are read on
+// from those ids instead of counting rows from the first land.
+struct ListCursor {
+  int32_t page  = 0;
+  int64_t first = 0;
+  int64_t last  = 0;
+};
+
+// Per-player state: a land selection in progress, a free slot has xuid 0
+struct Session {
+  uint64_t xuid    = 0;
+  int32_t lastSeen = 0;
+  Action action    = Action::None;
+  Vector3 pointA;
+  Vector3 pointB;
+  SelectionPreview preview;
+  ListCursor listed;
+};
+
+// Mining fires a burst of checks at the same block, they are answered from the last permission answer while the
+// region is unchanged. Only held while xuid is the player's.
+struct CachedDecision {
+  uint64_t xuid = 0;
+  LandIndex::Decision perm;
+};
+
+// Per-player state keyed by xuid.
+//
+// Fixed-capacity open addressing table, so the event hooks look a player up without allocating, usually in a single
+// probe. Sessions left idle for settings.sessionTimeout seconds are dropped.
+//
+// Permission answers are kept apart in a direct-mapped array of small entries, every player checking blocks gets one
+// without taking a session. Two players mapped to the same entry take turns missing.
+// Only used from the server thread, like the hooks and commands that drive it.
+class SessionTable {
+public:
+  static constexpr size_t kCapacity = 1024;
+
+  // Kept below 3/4 full so probe chains stay short
+  static constexpr size_t kMaxSessions = kCapacity / 4 * 3;
+
+  static constexpr size_t kDecisions = 4096;
+
+  // The player's live session, its idle timer restarts
+  Session *Find(uint64_t xuid);
+
+  // The player's session, created when there is none, nullptr if the table is full
+  Session *Open(uint64_t xuid);
+
+  void Close(uint64_t xuid);
+
+  // Entry the player's permission answer goes in, it holds someone else's while its xuid differs
+  inline CachedDecision &Decision(uint64_t xuid) { return decisions[mix(xuid) & (kDecisions - 1)]; }
+
+  inline size_t Size() const { return size; }
+
+private:
+  static int32_t now();
+  static inline size_t mix(uint64_t xuid) {
+    // xuids are handed out close together, mix the bits before masking
+    xuid ^= xuid >> 33;
+    xuid *= 0xff51afd7ed558ccdull;
+    xuid ^= xuid >> 33;
+    return (size_t) xuid;
+  }
+  static inline size_t home(uint64_t xuid) { return mix(xuid) & (kCapacity - 1); }
+
+  size_t find(uint64_t xuid) const;
+  bool expired(const Session &session, int32_t time) const;
+  void erase(size_t i);
+  void evictIdle();
+
+  Session slots[kCapacity];
+  size_t size = 0;
+
+  CachedDecision decisions[kDecisions];
+};
+
+extern SessionTable sessions;
@@ -1,24 +1,58 @@
 #pragma once
 
 #include <algorithm>
+#include <cmath>
 #include <yaml.h>
+#include <chrono>
 #include <string>
+#include <functional>
+#include <vector>
 #include <optional>
-#include <nlohmann/json.hpp>
-#include <boost/scope_exit.hpp>
-#include <SQLiteCpp/SQLiteCpp.h>
 
 #include <log.h>
 #include <playerdb.h>
 
+#include "sharedindex.h"
+
 struct Settings {
   int blockPrice = 1;
   int limit      = 3;
 
+  // Seconds between land stats dumps to the log, 0 disables them
+  int statsInterval = 0;
+
+  // Cross-check the per-owner totals against the database at startup
+  bool verifyTotals = false;
+
+  // Seconds a player's selection is kept without any activity, 0 keeps it forever
+  int sessionTimeout = 300;
+
+  // MiB of land data kept in memory, past it the least recently used regions are dropped. 0 never drops any
+  int memoryBudget = 64;
+
+  // File the audit hooks record their permission checks to for landreplay, empty records nothing. Past traceSize MiB
+  // it is rotated to <trace>.1
+  std::string trace;
+  int traceSize = 64;
+
+  // Seconds of land each rent payment buys, 0 disables rent and expiry. A payment costs rentPercent of what the land
+  // was bought for and is only taken while the owner is online. Lands left unpaid for rentGrace seconds past their
+  // deadline are reclaimed, with rentPercent 0 that simply expires lands whose owner stopped playing.
+  int rentInterval = 0;
+  int rentPercent  = 1;
+  int rentGrace    = 604800;
+
   std::string database = "landmanager.db";
+  std::string journal  = "landmanager.journal";
+  std::string snapshot = "landmanager.snapshot";
 
   template <typename IO> static inline bool io(IO f, Settings &settings, YAML::Node &node) {
-    return f(settings.blockPrice, node["blockPrice"]) && f(settings.limit, node["limit"]);
+    return f(settings.blockPrice, node["blockPrice"]) && f(settings.limit, node["limit"]) &&
+           f(settings.statsInterval, node["statsInterval"]) && f(settings.verifyTotals, node["verifyTotals"]) &&
+           f(settings.sessionTimeout, node["sessionTimeout"]) && f(settings.memoryBudget, node["memoryBudget"]) &&
+           f(settings.trace, node["trace"]) && f(settings.traceSize, node["traceSize"]) &&
+           f(settings.rentInterval, node["rentInterval"]) && f(settings.rentPercent, node["rentPercent"]) &&
+           f(settings.rentGrace, node["rentGrace"]);
   }
 };
 
@@ -27,25 +61,37 @@ inline Settings settings;
 struct Vector3 {
   bool init = false;
   int X, Y, Z;
+  int Dim = 0;
 
   inline Vector3(void) { init = false; }
-  inline Vector3(const int x, const int y, const int z) {
+  inline Vector3(const int x, const int y, const int z, const int dim = 0) {
     init = true;
     X    = x;
     Y    = y;
     Z    = z;
+    Dim  = dim;
   }
 
-  inline Vector3 operator+(const Vector3 &A) const { return Vector3(X + A.X, Y + A.Y, Z + A.Z); }
+  // The block holding a finite position, rounded toward negative infinity so -0.5 lands in block -1 like the game
+  // does. Positions beyond the int range are clamped to its ends.
+  static inline Vector3 Block(const float x, const float y, const float z, const int dim = 0) {
+    auto snap = [](const float v) {
+      return (int) std::clamp(std::floor((double) v), (double) INT32_MIN, (double) INT32_MAX);
+    };
+    return Vector3(snap(x), snap(y), snap(z), dim);
+  }
 
-  inline Vector3 operator+(const int A) const { return Vector3(X + A, Y + A, Z + A); }
+  inline Vector3 operator+(const Vector3 &A) const { return Vector3(X + A.X, Y + A.Y, Z + A.Z, Dim); }
+
+  inline Vector3 operator+(const int A) const { return Vector3(X + A, Y + A, Z + A, Dim); }
 
   inline int Dot(const Vector3 &A) const { return A.X * X + A.Y * Y + A.Z * Z; }
 
-  inline int Volume(const Vector3 &A) const {
-    int x2 = abs(A.X - X) + 1;
-    int y2 = abs(A.Y - Y) + 1;
-    int z2 = abs(A.Z - Z) + 1;
+  // Blocks between the two points, both included. Any two points in the world fit in 64 bits.
+  inline int64_t Volume(const Vector3 &A) const {
+    int64_t x2 = std::abs((int64_t) A.X - X) + 1;
+    int64_t y2 = std::abs((int64_t) A.Y - Y) + 1;
+    int64_t z2 = std::abs((int64_t) A.Z - Z) + 1;
 
     return x2 * y2 * z2;
   }
@@ -66,35 +112,78 @@ struct Cube {
   inline int xMax() { return std::max(A.X, B.X); }
   inline int yMax() { return std::max(A.Y, B.Y); }
   inline int zMax() { return std::max(A.Z, B.Z); }
+  inline int Dim() { return A.Dim; }
+
+  inline LandBox Box() { return LandBox(A.X, A.Y, A.Z, B.X, B.Y, B.Z); }
 };
 
-extern std::unique_ptr<SQLite::Database> landDB;
+// What a land of the given volume costs, selections too large to price cost the most there is
+inline int64_t LandPrice(int64_t volume) {
+  if (settings.blockPrice > 0 && volume > INT64_MAX / settings.blockPrice) return INT64_MAX;
+  return volume * settings.blockPrice;
+}
+
+extern SharedLandIndex landIndex;
+
+Vector3 getChunk(Vector3 vec);
+std::vector<int64_t> findStandingLand(Mod::PlayerEntry player, Vector3 block);
 
 namespace LandManager {
+// Groups land mutations so they become visible and get queued for the writer together, or not at all
 class Transaction {
-  SQLite::Transaction trans;
+  std::vector<LandMutation> staged;
+  Transaction *outer;
+
+  friend void Submit(const LandMutation &mutation);
 
 public:
   Transaction();
+  ~Transaction();
+  Transaction(const Transaction &) = delete;
+  Transaction &operator=(const Transaction &) = delete;
+
   void Commit();
 };
 
 void InitDatabase();
+void RecoverJournal();
+void StartWriter();
+bool FlushDatabase();
+bool WaitForWriter(size_t pending, std::chrono::milliseconds timeout);
+
+// Waits only for the queued changes to the owner's lands, or to lands whose owner was not known when they were queued
+bool WaitForOwner(uint64_t owner, std::chrono::milliseconds timeout);
+void OnDurable(std::function<void()> ack);
+void SaveSnapshot();
+bool VerifyTotals();
+int64_t NextLandId();
+std::vector<LandMutation> PendingMutations();
+void StartRecording();
+bool RecordedMutations(
+    int dim, int32_t tx, int32_t tz, const std::vector<int64_t> &ids, size_t max, std::vector<LandMutation> &out);
+void Submit(const LandMutation &mutation);
 
 std::optional<Mod::PlayerEntry> GetPlayerInstance(Player *player);
 std::optional<std::string> ReachedLimit(Mod::PlayerEntry owner);
+std::vector<LandRecord> Conflicts(Vector3 start, Vector3 end);
 std::optional<std::string> Overlaps(Mod::PlayerEntry owner, Vector3 start, Vector3 end);
 bool HasPerm(Mod::PlayerEntry player, Vector3 block);
+bool CheckPerm(Mod::PlayerEntry player, Vector3 block);
 std::optional<std::string> BuyLand(Mod::PlayerEntry owner, Vector3 start, Vector3 end);
 std::string SellLand(Mod::PlayerEntry player, Vector3 block);
-std::string GiveLand(Mod::PlayerEntry player, Vector3 block);
+std::string GiveLand(Mod::PlayerEntry player, Mod::PlayerEntry target, Vector3 block);
+std::string TrustPlayer(Mod::PlayerEntry player, Mod::PlayerEntry target, Vector3 block);
+std::string UntrustPlayer(Mod::PlayerEntry player, Mod::PlayerEntry target, Vector3 block);
 } // namespace LandManager
 
-enum class Action { None, Create, Buy, Sell, Give, Exit };
+enum class Action { None, Create, Buy, Sell, Give, Exit, Stats, Trust, Untrust, Import, Export, List, Near, Audit };
 
-extern Action action;
-extern Vector3 pointA;
-extern Vector3 pointB;
+std::string statsReport();
 
 class CommandRegistry;
-void initCommand(CommandRegistry *registry);
\ No newline at end of file
+void initCommand(CommandRegistry *registry);
+
+// Imports, exports and audits run off the server thread. The server tick tells whoever asked once one is done, and
+// the database is only closed after a running one finished.
+void reportBulkJob();
+void joinBulkJob();
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include "sharedindex.h"
+
+#include <thread>
+
+bool SharedLandIndex::Indicator::Empty() const {
+  for (const Stripe &stripe : stripes) {
+    if (stripe.readers.load() != 0) return false;
+  }
+
+  return true;
+}
+
+int SharedLandIndex::stripe() {
+  static std::atomic<int> next{0};
+  thread_local int stripe = next.fetch_add(1, std::memory_order_relaxed) % kStripes;
+
+  return stripe;
+}
+
+// Readers that arrived before the swap may be in either group, so both have to empty out. New readers are sent to
+// the group that was just drained, which is what lets the second wait finish even under constant read traffic.
+void SharedLandIndex::drain() {
+  int previous = version.load();
+  int next     = 1 - previous;
+
+  while (!indicators[next].Empty()) std::this_thread::yield();
+  version.store(next);
+  while (!indicators[previous].Empty()) std::this_thread::yield();
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "landindex.h"
+
+// Land index readable from any thread without taking a lock.
+//
+// Left-right publication: there are two copies of the index, readers use whichever one is published and the single
+// writer edits the other. After a change the writer publishes the copy it edited, waits for readers still inside the
+// old one to leave and repeats the change there. Reads never block and never see a half applied change, a write
+// costs applying it twice plus the time in-flight reads take to drain. A thread must not write while it holds a
+// Reader, the writer would wait for itself.
+class SharedLandIndex {
+  static constexpr int kStripes = 16;
+
+  // Reader counts are spread over cache lines so threads on different cores do not bounce the same one
+  struct alignas(64) Stripe {
+    std::atomic<int64_t> readers{0};
+  };
+
+  struct Indicator {
+    Stripe stripes[kStripes];
+
+    bool Empty() const;
+  };
+
+public:
+  // Keeps the copy it points to alive, release it before writing. Moving hands the copy over, it is still released
+  // only once.
+  class Reader {
+  public:
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    inline Reader(Reader &&other) : index(other.index), counter(other.counter) { other.counter = nullptr; }
+
+    inline ~Reader() {
+      if (counter) counter->fetch_sub(1, std::memory_order_release);
+    }
+
+    inline const LandIndex *operator->() const { return index; }
+    inline const LandIndex &operator*() const { return *index; }
+
+  private:
+    friend class SharedLandIndex;
+
+    inline Reader(const LandIndex *index, std::atomic<int64_t> *counter) : index(index), counter(counter) {}
+
+    const LandIndex *index;
+    std::atomic<int64_t> *counter;
+  };
+
+  inline Reader Read() const {
+    std::atomic<int64_t> &counter = indicators[version.load()].stripes[stripe()].readers;
+    counter.fetch_add(1);
+
+    return Reader(&copies[active.load()], &counter);
+  }
+
+  // f is called once on each copy, so it must make the same change both times
+  template <typename F> void Write(F f) {
+    std::lock_guard lock(writerMutex);
+    int published = active.load();
+
+    f(copies[1 - published]);
+    active.store(1 - published);
+
+    drain();
+    f(copies[published]);
+  }
+
+  inline void Apply(const LandMutation &mutation) {
+    Write([&](LandIndex &index) { index.Apply(mutation); });
+  }
+
+private:
+  static int stripe();
+
+  // Waits until no reader can still be using the copy that was published before the last swap
+  void drain();
+
+  LandIndex copies[2];
+  mutable Indicator indicators[2];
+  std::atomic<int> active{0};
+  std::atomic<int> version{0};
+  std::mutex writerMutex;
+};
@@ -0,0 +1,239 @@
+#include "snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static_assert(sizeof(LandSnapshot::Header) == 64, "snapshot layout changed, bump kVersion");
+static_assert(sizeof(LandSnapshot::Owner) == 24, "snapshot layout changed, bump kVersion");
+static_assert(sizeof(LandSnapshot::TileEntry) == 24, "snapshot layout changed, bump kVersion");
+static_assert(sizeof(LandSnapshot::Land) == 56, "snapshot layout changed, bump kVersion");
+
+namespace {
+
+const char kMagic[8] = {'L', 'M', 'S', 'N', 'A', 'P', 0, 0};
+
+bool before(const LandSnapshot::TileEntry &a, const LandSnapshot::TileEntry &b) {
+  if (a.dim != b.dim) return a.dim < b.dim;
+  if (a.x != b.x) return a.x < b.x;
+  return a.z < b.z;
+}
+
+} // namespace
+
+MappedFile::~MappedFile() { Close(); }
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::string &path) {
+  Close();
+
+  file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    file = nullptr;
+    return false;
+  }
+
+  LARGE_INTEGER length;
+  if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) {
+    Close();
+    return false;
+  }
+
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping) {
+    Close();
+    return false;
+  }
+
+  data = (const uint8_t *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) {
+    Close();
+    return false;
+  }
+
+  size = (size_t) length.QuadPart;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data) UnmapViewOfFile(data);
+  if (mapping) CloseHandle(mapping);
+  if (file) CloseHandle(file);
+
+  data    = nullptr;
+  size    = 0;
+  mapping = nullptr;
+  file    = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const std::string &path) {
+  Close();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  // The mapping keeps the file alive on its own
+  void *view = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (view == MAP_FAILED) return false;
+
+  data = (const uint8_t *) view;
+  size = (size_t) info.st_size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data) munmap((void *) data, size);
+
+  data = nullptr;
+  size = 0;
+}
+
+#endif
+
+// FNV-1a over 64-bit words, the sections are all whole words
+uint64_t LandSnapshot::checksum(const uint8_t *data, size_t size) {
+  uint64_t hash = 14695981039346656037ull;
+
+  for (size_t i = 0; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    hash ^= word;
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
+
+bool LandSnapshot::Write(const std::string &path, uint32_t schema, uint64_t token, const Data &data) {
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.schema  = schema;
+  header.token   = token;
+  header.owners  = data.owners.size();
+  header.tiles   = data.tiles.size();
+  header.lands   = data.lands.size();
+  header.trusts  = data.trusts.size();
+
+  // Checksummed section by section, the same as one pass over the file body
+  std::vector<uint8_t> body;
+  auto append = [&](const void *items, size_t bytes) {
+    body.insert(body.end(), (const uint8_t *) items, (const uint8_t *) items + bytes);
+  };
+
+  append(data.owners.data(), data.owners.size() * sizeof(Owner));
+  append(data.tiles.data(), data.tiles.size() * sizeof(TileEntry));
+  append(data.lands.data(), data.lands.size() * sizeof(Land));
+  append(data.trusts.data(), data.trusts.size() * sizeof(uint64_t));
+  header.checksum = checksum(body.data(), body.size());
+
+  std::string temp = path + ".tmp";
+  std::FILE *file  = std::fopen(temp.c_str(), "wb");
+  if (!file) return false;
+
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 (body.empty() || std::fwrite(body.data(), 1, body.size(), file) == body.size());
+  written = std::fflush(file) == 0 && written;
+  written = std::fclose(file) == 0 && written;
+
+  std::error_code error;
+  if (written) std::filesystem::rename(temp, path, error);
+  if (!written || error) {
+    std::filesystem::remove(temp, error);
+    return false;
+  }
+
+  return true;
+}
+
+bool LandSnapshot::Open(const std::string &path, uint32_t schema, uint64_t token) {
+  Close();
+
+  if (!file.Open(path)) return false;
+
+  const uint8_t *base = file.Data();
+  auto *candidate     = (const Header *) base;
+
+  bool valid = file.Size() >= sizeof(Header) && !std::memcmp(candidate->magic, kMagic, sizeof(kMagic)) &&
+               candidate->version == kVersion && candidate->schema == schema && candidate->token == token;
+
+  // Counts are checked against the real size before anything is summed, a damaged header must not read past the end
+  if (valid) {
+    uint64_t body = candidate->owners * sizeof(Owner) + candidate->tiles * sizeof(TileEntry) +
+                    candidate->lands * sizeof(Land) + candidate->trusts * sizeof(uint64_t);
+    valid = candidate->owners < file.Size() && candidate->tiles < file.Size() && candidate->lands < file.Size() &&
+            candidate->trusts < file.Size() && sizeof(Header) + body == file.Size();
+  }
+
+  if (valid) valid = checksum(base + sizeof(Header), file.Size() - sizeof(Header)) == candidate->checksum;
+
+  if (!valid) {
+    file.Close();
+    return false;
+  }
+
+  header = candidate;
+  owners = (const Owner *) (base + sizeof(Header));
+  tiles  = (const TileEntry *) (owners + header->owners);
+  lands  = (const Land *) (tiles + header->tiles);
+  trusts = (const uint64_t *) (lands + header->lands);
+
+  return true;
+}
+
+void LandSnapshot::Close() {
+  file.Close();
+  header = nullptr;
+  owners = nullptr;
+  tiles  = nullptr;
+  lands  = nullptr;
+  trusts = nullptr;
+}
+
+void LandSnapshot::Tile(int dim, int32_t tx, int32_t tz, std::vector<PagedLand> &out) const {
+  TileEntry key{dim, tx, tz, 0, 0};
+  const TileEntry *end = tiles + header->tiles;
+  const TileEntry *it  = std::lower_bound(tiles, end, key, before);
+
+  if (it == end || before(key, *it)) return;
+
+  for (uint64_t i = it->first; i < it->first + it->count && i < header->lands; i++) {
+    const Land &entry = lands[i];
+    PagedLand page;
+
+    page.land.id    = entry.id;
+    page.land.owner = entry.owner;
+    page.land.dim   = dim;
+    page.land.box   = LandBox(entry.box[0], entry.box[1], entry.box[2], entry.box[3], entry.box[4], entry.box[5]);
+    page.land.depth = entry.depth;
+
+    if ((uint64_t) entry.trustFirst + entry.trustCount <= header->trusts) {
+      page.trusted.assign(trusts + entry.trustFirst, trusts + entry.trustFirst + entry.trustCount);
+    }
+
+    out.push_back(std::move(page));
+  }
+}
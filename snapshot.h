@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "region.h"
+
+// Read-only view of a whole file mapped into memory
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool Open(const std::string &path);
+  void Close();
+
+  inline const uint8_t *Data() const { return data; }
+  inline size_t Size() const { return size; }
+
+private:
+  const uint8_t *data = nullptr;
+  size_t size         = 0;
+#if defined(_WIN32)
+  void *file    = nullptr;
+  void *mapping = nullptr;
+#endif
+};
+
+// Flat copy of the stored lands, a page-in copies a tile's entries out of a mapping instead of querying the database.
+// Lookups never read it directly, it only makes loading a tile cheap.
+//
+// Laid out as a header, the per-owner totals, a tile directory sorted by (dim, x, z), one land entry per tile a land
+// is stored under and the trusted xuids the entries point into. Every part is 8-byte aligned, so entries are read
+// straight from the mapping. The header carries a format version, the schema version and a random token the database
+// keeps in its meta table until the writer commits anything, so a snapshot only opens against the exact database
+// state it was written from.
+class LandSnapshot {
+public:
+  static constexpr uint32_t kVersion = 2;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t schema;
+    uint64_t token;
+    uint64_t owners;
+    uint64_t tiles;
+    uint64_t lands;
+    uint64_t trusts;
+    uint64_t checksum;
+  };
+
+  struct Owner {
+    uint64_t owner;
+    int64_t volume;
+    int64_t lands;
+  };
+
+  struct TileEntry {
+    int32_t dim, x, z;
+    uint32_t count;
+    uint64_t first;
+  };
+
+  struct Land {
+    int64_t id;
+    uint64_t owner;
+    int32_t box[6];
+    uint32_t trustFirst;
+    uint32_t trustCount;
+    int32_t depth;
+    uint32_t reserved;
+  };
+
+  struct Data {
+    std::vector<Owner> owners;
+    std::vector<TileEntry> tiles;
+    std::vector<Land> lands;
+    std::vector<uint64_t> trusts;
+  };
+
+  // Written next to the target and renamed over it, a crash never leaves a half written snapshot behind
+  static bool Write(const std::string &path, uint32_t schema, uint64_t token, const Data &data);
+
+  // False if the file is missing, damaged or was written from another database state, the snapshot stays closed
+  bool Open(const std::string &path, uint32_t schema, uint64_t token);
+  void Close();
+
+  inline bool IsOpen() const { return header != nullptr; }
+
+  // Adds every land stored under the tile
+  void Tile(int dim, int32_t tx, int32_t tz, std::vector<PagedLand> &out) const;
+
+  template <typename F> void ForEachOwner(F f) const {
+    for (uint64_t i = 0; i < header->owners; i++) f(owners[i]);
+  }
+
+private:
+  static uint64_t checksum(const uint8_t *data, size_t size);
+
+  MappedFile file;
+  const Header *header   = nullptr;
+  const Owner *owners    = nullptr;
+  const TileEntry *tiles = nullptr;
+  const Land *lands      = nullptr;
+  const uint64_t *trusts = nullptr;
+};
@@ -0,0 +1,98 @@
+#include "stats.h"
+
+#include <cstdio>
+
+static const char *probeNames[] = {
+    "HasPerm",  "findStandingLand", "Conflicts",     "Overlaps",      "ReachedLimit", "BuyLand",
+    "SellLand", "GiveLand",         "DeniedRegions", "AllowedBlocks", "InitDatabase", "WriterCommit",
+    "PageIn",   "CollectRent",      "ListLands",     "NearLands",     "PreviewSelection",
+};
+
+static_assert(sizeof(probeNames) / sizeof(*probeNames) == (size_t) Probe::Count, "every probe needs a name");
+
+uint64_t LatencyHistogram::Percentile(double q) const {
+  uint64_t total = Count();
+  if (total == 0) return 0;
+
+  uint64_t target = (uint64_t) (q * (total - 1)) + 1;
+  uint64_t seen   = 0;
+
+  for (int i = 0; i < kBuckets; i++) {
+    seen += buckets[i].load(std::memory_order_relaxed);
+    if (seen >= target) return upperBound(i);
+  }
+
+  return upperBound(kBuckets - 1);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+  for (int i = 0; i < kBuckets; i++) buckets[i].fetch_add(other.buckets[i].load(), std::memory_order_relaxed);
+
+  count.fetch_add(other.count.load(), std::memory_order_relaxed);
+  total.fetch_add(other.total.load(), std::memory_order_relaxed);
+}
+
+static void line(std::string &out, const char *name, const ProbeStats &probe) {
+  const LatencyHistogram &h = probe.latency;
+  if (h.Count() == 0) return;
+
+  char buffer[160];
+  std::snprintf(
+      buffer, sizeof(buffer), "%-22s n=%llu mean=%lluns p50=%lluns p99=%lluns denied=%llu\n", name,
+      (unsigned long long) h.Count(), (unsigned long long) h.Mean(), (unsigned long long) h.Percentile(0.5),
+      (unsigned long long) h.Percentile(0.99), (unsigned long long) probe.denied.load(std::memory_order_relaxed));
+  out += buffer;
+}
+
+std::string LandStats::Report(NameFn actionName, NameFn transactionName, NameFn actorUseName) const {
+  std::string out;
+
+  for (int i = 0; i < (int) Probe::Count; i++) line(out, probeNames[i], probes[i]);
+  for (int i = 0; i < kMaxKinds; i++) line(out, actionName(i).c_str(), actions[i]);
+  for (int i = 0; i < kMaxKinds; i++) line(out, transactionName(i).c_str(), transactions[i]);
+  for (int i = 0; i < kMaxKinds; i++) line(out, actorUseName(i).c_str(), actorUses[i]);
+
+  uint64_t hits   = cacheHits.load(std::memory_order_relaxed);
+  uint64_t misses = cacheMisses.load(std::memory_order_relaxed);
+
+  if (hits + misses) {
+    char buffer[96];
+    std::snprintf(
+        buffer, sizeof(buffer), "perm cache: hits=%llu misses=%llu hit rate=%.1f%%\n", (unsigned long long) hits,
+        (unsigned long long) misses, 100.0 * hits / (hits + misses));
+    out += buffer;
+  }
+
+  uint64_t paged = pagedTiles.load(std::memory_order_relaxed);
+
+  if (paged) {
+    out += "regions: paged in=" + std::to_string(paged) +
+           " evicted=" + std::to_string(evictedTiles.load(std::memory_order_relaxed)) + "\n";
+  }
+
+  uint64_t traced  = tracedEvents.load(std::memory_order_relaxed);
+  uint64_t dropped = droppedEvents.load(std::memory_order_relaxed);
+
+  if (traced + dropped) {
+    out += "trace: recorded=" + std::to_string(traced) + " dropped=" + std::to_string(dropped) + "\n";
+  }
+
+  out += "pending writes: " + std::to_string(pendingWrites.load(std::memory_order_relaxed));
+  return out;
+}
+
+bool LandStats::DumpDue(int intervalSeconds) {
+  if (intervalSeconds <= 0) return false;
+
+  auto uptime = std::chrono::steady_clock::now().time_since_epoch();
+  int64_t now = std::chrono::duration_cast<std::chrono::seconds>(uptime).count();
+
+  int64_t next = nextDump.load(std::memory_order_relaxed);
+
+  if (next == 0) {
+    nextDump.compare_exchange_strong(next, now + intervalSeconds, std::memory_order_relaxed);
+    return false;
+  }
+
+  return now >= next && nextDump.compare_exchange_strong(next, now + intervalSeconds, std::memory_order_relaxed);
+}
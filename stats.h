@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+// Lock-free log-linear latency histogram.
+//
+// Each power of two is split in four buckets, so percentiles are within 25% of the real value while recording
+// stays a couple of relaxed atomic increments.
+class LatencyHistogram {
+public:
+  static constexpr int kBuckets = 256;
+
+  inline void Record(uint64_t ns) {
+    buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  inline uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+  inline uint64_t Mean() const { return Count() ? total.load(std::memory_order_relaxed) / Count() : 0; }
+
+  // Upper bound of the bucket holding the q-th quantile, in nanoseconds
+  uint64_t Percentile(double q) const;
+
+  // Adds every sample of other, which must not be recording at the same time
+  void Merge(const LatencyHistogram &other);
+
+  static inline int bucketOf(uint64_t ns) {
+    if (ns < 4) return (int) ns;
+
+    int exp = msb(ns);
+    return 4 * (exp - 1) + (int) ((ns >> (exp - 2)) & 3);
+  }
+
+  static inline uint64_t upperBound(int bucket) {
+    if (bucket < 4) return bucket;
+
+    int exp = bucket / 4 + 1;
+    return ((uint64_t) (4 + bucket % 4 + 1) << (exp - 2)) - 1;
+  }
+
+private:
+  static inline int msb(uint64_t value) {
+    int bit = 0;
+    while (value >>= 1) bit++;
+    return bit;
+  }
+
+  std::atomic<uint64_t> buckets[kBuckets] = {};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> total{0};
+};
+
+struct ProbeStats {
+  LatencyHistogram latency;
+  std::atomic<uint64_t> denied{0};
+
+  inline void Deny() { denied.fetch_add(1, std::memory_order_relaxed); }
+};
+
+enum class Probe : int {
+  HasPerm,
+  FindStanding,
+  Conflicts,
+  Overlaps,
+  ReachedLimit,
+  BuyLand,
+  SellLand,
+  GiveLand,
+  DeniedRegions,
+  AllowedBlocks,
+  InitDatabase,
+  WriterCommit,
+  PageIn,
+  CollectRent,
+  ListLands,
+  NearLands,
+  PreviewSelection,
+  Count
+};
+
+class LandStats {
+public:
+  // Hook event types are indexed by their raw enum value, anything past the table shares the last slot
+  static constexpr int kMaxKinds = 64;
+
+  using NameFn = std::string (*)(int kind);
+
+  ProbeStats probes[(int) Probe::Count];
+  ProbeStats actions[kMaxKinds];
+  ProbeStats transactions[kMaxKinds];
+  ProbeStats actorUses[kMaxKinds];
+
+  std::atomic<uint64_t> pendingWrites{0};
+
+  // Permission checks answered from the per-player cache, and the ones that had to ask the index
+  std::atomic<uint64_t> cacheHits{0};
+  std::atomic<uint64_t> cacheMisses{0};
+
+  // Region tiles loaded from the database and dropped again to stay under the memory budget
+  std::atomic<uint64_t> pagedTiles{0};
+  std::atomic<uint64_t> evictedTiles{0};
+
+  // Audit events written to the trace, and the ones dropped because the writer fell behind
+  std::atomic<uint64_t> tracedEvents{0};
+  std::atomic<uint64_t> droppedEvents{0};
+
+  inline ProbeStats &operator[](Probe probe) { return probes[(int) probe]; }
+  inline ProbeStats &Action(int kind) { return actions[clamp(kind)]; }
+  inline ProbeStats &Transaction(int kind) { return transactions[clamp(kind)]; }
+  inline ProbeStats &ActorUse(int kind) { return actorUses[clamp(kind)]; }
+
+  // One line per probe or event kind that has seen traffic
+  std::string Report(NameFn actionName, NameFn transactionName, NameFn actorUseName) const;
+
+  // True once per interval, for whoever gets there first
+  bool DumpDue(int intervalSeconds);
+
+private:
+  static inline int clamp(int kind) { return kind >= 0 && kind < kMaxKinds ? kind : kMaxKinds - 1; }
+
+  std::atomic<int64_t> nextDump{0};
+};
+
+inline LandStats landStats;
+
+// Records the time spent in the enclosing scope
+class ScopedTimer {
+  using Clock = std::chrono::steady_clock;
+
+  LatencyHistogram &histogram;
+  Clock::time_point start;
+
+public:
+  inline ScopedTimer(LatencyHistogram &histogram) : histogram(histogram), start(Clock::now()) {}
+  inline ScopedTimer(ProbeStats &probe) : ScopedTimer(probe.latency) {}
+  inline ~ScopedTimer() {
+    histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+  }
+};
@@ -0,0 +1,35 @@
+#include "timerwheel.h"
+
+void TimerWheel::Reset(int64_t now) {
+  for (auto &level : slots) {
+    for (std::vector<Timer> &slot : level) slot.clear();
+  }
+
+  current = now;
+  count   = 0;
+}
+
+void TimerWheel::Schedule(int64_t id, int64_t deadline) {
+  int64_t at = deadline < current ? current : deadline;
+  int level  = 0;
+
+  while (level < kLevels - 1 && (at >> (kBits * (level + 1))) != (current >> (kBits * (level + 1)))) level++;
+
+  slots[level][(at >> (kBits * level)) & (kSlots - 1)].push_back({id, deadline});
+  count++;
+}
+
+// Called each time level 0 wraps, a level only moves its next slot down when every level below it wrapped too
+void TimerWheel::cascade() {
+  for (int level = 1; level < kLevels; level++) {
+    int index = (int) ((current >> (kBits * level)) & (kSlots - 1));
+
+    fired.swap(slots[level][index]);
+    count -= fired.size();
+
+    for (const Timer &timer : fired) Schedule(timer.id, timer.deadline);
+    fired.clear();
+
+    if (index != 0) break;
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timing wheel over whole seconds.
+//
+// Level L has kSlots slots each kSlots^L seconds wide, a timer sits in the lowest level whose current span still
+// holds its deadline. Advancing one second empties a single level 0 slot, and every kSlots seconds the next slot of
+// the level above is spread over the levels below it. Scheduling and advancing cost the same whether a hundred or a
+// million timers are pending. Timers cannot be cancelled, whoever fires them checks they are still wanted.
+class TimerWheel {
+public:
+  static constexpr int kBits   = 6;
+  static constexpr int kSlots  = 1 << kBits;
+  static constexpr int kLevels = 6;
+
+  struct Timer {
+    int64_t id;
+    int64_t deadline;
+  };
+
+  // Drops every timer, the wheel starts at now
+  void Reset(int64_t now);
+
+  // A deadline already passed fires on the next advance, one past the last level is parked there until it comes close
+  void Schedule(int64_t id, int64_t deadline);
+
+  // Calls f(id, deadline) for every timer due at or before now
+  template <typename F> void Advance(int64_t now, F f) {
+    while (current <= now) {
+      // Nothing pending, no slot between here and now can hold anything
+      if (count == 0) {
+        current = now + 1;
+        return;
+      }
+
+      std::vector<Timer> &slot = slots[0][current & (kSlots - 1)];
+
+      if (!slot.empty()) {
+        fired.swap(slot);
+        count -= fired.size();
+
+        for (const Timer &timer : fired) {
+          if (timer.deadline <= current) {
+            f(timer.id, timer.deadline);
+          } else {
+            Schedule(timer.id, timer.deadline);
+          }
+        }
+
+        fired.clear();
+      }
+
+      current++;
+      if ((current & (kSlots - 1)) == 0) cascade();
+    }
+  }
+
+  inline size_t Size() const { return count; }
+  inline int64_t Now() const { return current; }
+
+private:
+  void cascade();
+
+  std::vector<Timer> slots[kLevels][kSlots];
+  std::vector<Timer> fired;
+  int64_t current = 0;
+  size_t count    = 0;
+};
@@ -0,0 +1,485 @@
+// Benchmarks for the land permission hot paths.
+//
+// Builds synthetic worlds straight into the index and times the same LandManager calls the audit hooks and the land
+// command use. Also reports what the index costs in heap per million resident lands, what a rent tick costs as the
+// lands grow and what permission checks cost inside towns divided into nested plots. Readers racing a writer are
+// checked by landstress.
+// Usage: landbench [--full] [--ops N] [--budget MS] [--seed N] [--kernel scalar|avx2|avx512]
+
+#include <map>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "settings.h"
+#include "session.h"
+#include "region.h"
+#include "timerwheel.h"
+#include "landmanager.h"
+
+SharedLandIndex landIndex;
+SessionTable sessions;
+RegionCache regions;
+
+// Stand-ins for persistence.cpp, mutations are applied to the index directly instead of being queued for SQLite
+
+namespace {
+thread_local LandManager::Transaction *current = nullptr;
+int64_t nextLandId                             = 1;
+} // namespace
+
+int64_t LandManager::NextLandId() { return nextLandId++; }
+
+void LandManager::Submit(const LandMutation &mutation) {
+  if (current) {
+    current->staged.push_back(mutation);
+    return;
+  }
+
+  landIndex.Apply(mutation);
+}
+
+LandManager::Transaction::Transaction() : outer(current) { current = this; }
+
+LandManager::Transaction::~Transaction() {
+  if (current == this) current = outer;
+}
+
+void LandManager::Transaction::Commit() {
+  current = outer;
+  for (const LandMutation &mutation : staged) Submit(mutation);
+  staged.clear();
+}
+
+Vector3 getChunk(Vector3 vec) { return Vector3(vec.X >> 4, vec.Y >> 4, vec.Z >> 4); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Layout { Uniform, Clustered, Dense };
+
+struct World {
+  size_t lands;
+  Layout layout;
+  int minSize, maxSize;
+};
+
+struct Options {
+  bool full     = false;
+  size_t ops    = 200000;
+  int budgetMs  = 2000;
+  uint32_t seed = 1;
+
+  LandSimd::Level kernel = LandSimd::Detect();
+} options;
+
+std::mt19937 rng;
+std::vector<LandRecord> placed;
+int radius = 0;
+
+int random(int min, int max) { return std::uniform_int_distribution<int>(min, max)(rng); }
+
+int coordinate(Layout layout) {
+  if (layout == Layout::Uniform) return random(-radius, radius);
+
+  // Most claims end up around spawn, a few stray far away
+  double value = std::normal_distribution<double>(0.0, radius / 8.0)(rng);
+  return (int) std::max<double>(-radius, std::min<double>(radius, value));
+}
+
+LandBox randomBox(const World &world) {
+  int x = coordinate(world.layout);
+  int z = coordinate(world.layout);
+  int y = random(0, 200);
+
+  int w = random(world.minSize, world.maxSize);
+  int d = random(world.minSize, world.maxSize);
+
+  return LandBox(x, y, z, x + w - 1, y + random(8, 64), z + d - 1);
+}
+
+Mod::PlayerEntry playerFor(uint64_t xuid) {
+  Mod::PlayerEntry player;
+  player.xuid = xuid;
+  return player;
+}
+
+// A spawn city of 4x4 plots stacked in 8 block floors, 64 lands end up sharing every column
+void generateDense(const World &world) {
+  int side = (int) std::sqrt((double) world.lands / 4.0) + 1;
+  radius   = side * 4;
+
+  for (size_t i = 0; i < world.lands; i++) {
+    int x     = (int) (i % side) * 4 - radius / 2;
+    int z     = (int) (i / side % side) * 4 - radius / 2;
+    int floor = (int) (i / side / side);
+
+    LandRecord land;
+    land.id    = LandManager::NextLandId();
+    land.owner = (uint64_t) random(1, (int) std::max<size_t>(world.lands / 3, 1));
+    land.box   = LandBox(x, 64 + floor * 8, z, x + 3, 64 + floor * 8 + 7, z + 3);
+
+    placed.push_back(land);
+  }
+}
+
+// Lands never overlap in a real world, so placements that would are retried elsewhere
+void generatePlots(const World &world) {
+  LandIndex scratch;
+
+  double side = (world.minSize + world.maxSize) / 2.0;
+  radius      = (int) std::min<double>(std::sqrt((double) world.lands) * side * 2.0, 20000000.0);
+
+  size_t attempts = 0;
+
+  while (placed.size() < world.lands && attempts++ < world.lands * 8) {
+    LandBox box   = randomBox(world);
+    bool overlaps = false;
+
+    scratch.Overlapping(0, box, [&](const LandRecord &) {
+      overlaps = true;
+      return false;
+    });
+
+    if (overlaps) continue;
+
+    LandRecord land;
+    land.id    = LandManager::NextLandId();
+    land.owner = (uint64_t) random(1, (int) std::max<size_t>(world.lands / 3, 1));
+    land.box   = box;
+
+    scratch.Insert(land);
+    placed.push_back(land);
+  }
+}
+
+// Loaded in one write like InitDatabase does, so each copy of the index is laid out in one piece
+void generate(const World &world) {
+  placed.clear();
+  nextLandId = 1;
+
+  if (world.layout == Layout::Dense) {
+    generateDense(world);
+  } else {
+    generatePlots(world);
+  }
+
+  landIndex.Write([](LandIndex &index) {
+    index.Clear();
+    for (const LandRecord &land : placed) index.Insert(land);
+  });
+}
+
+Vector3 pointInside(const LandRecord &land) {
+  return Vector3(
+      random(land.box.X1, land.box.X2), random(land.box.Y1, land.box.Y2), random(land.box.Z1, land.box.Z2));
+}
+
+// Half the probes land inside a claim, the other half anywhere in the world
+Vector3 probe() {
+  if (random(0, 1)) return pointInside(placed[random(0, (int) placed.size() - 1)]);
+  return Vector3(random(-radius, radius), random(0, 255), random(-radius, radius));
+}
+
+template <typename F> void measure(const char *name, const char *op, F f) {
+  std::vector<uint32_t> samples;
+  samples.reserve(options.ops);
+
+  auto start    = Clock::now();
+  auto deadline = start + std::chrono::milliseconds(options.budgetMs);
+
+  while (samples.size() < options.ops && (samples.size() < 16 || Clock::now() < deadline)) {
+    auto begin = Clock::now();
+    f();
+    auto end = Clock::now();
+
+    samples.push_back((uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+  }
+
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  std::sort(samples.begin(), samples.end());
+
+  std::printf(
+      "%-28s %-10s %12.0f %10u %10u\n", name, op, samples.size() / seconds, samples[samples.size() / 2],
+      samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]);
+}
+
+void run(const World &world) {
+  generate(world);
+
+  char name[64];
+  static const char *layouts[] = {"uniform", "clustered", "dense"};
+  std::snprintf(
+      name, sizeof(name), "%zu %s %s", placed.size(), layouts[(int) world.layout], world.maxSize > 64 ? "huge" : "small");
+
+  volatile bool sink = false;
+
+  measure(name, "point", [&] { sink = LandManager::HasPerm(playerFor(random(1, 1000)), probe()); });
+
+  // Mining one block after another inside the same claim, the hooks go through the per-player cache
+  Vector3 mining;
+  size_t swings = 0;
+
+  measure(name, "burst", [&] {
+    if (swings++ % 16 == 0) mining = probe();
+    sink = LandManager::CheckPerm(playerFor(1 + swings / 16 % 500), Vector3(mining.X, mining.Y, mining.Z + swings % 4));
+  });
+
+  measure(name, "standing", [&] {
+    const LandRecord &land = placed[random(0, (int) placed.size() - 1)];
+    sink                   = !findStandingLand(playerFor(land.owner), pointInside(land)).empty();
+  });
+
+  measure(name, "overlap", [&] {
+    LandBox box = randomBox(world);
+    auto err    = LandManager::Overlaps(playerFor(1), Vector3(box.X1, box.Y1, box.Z1), Vector3(box.X2, box.Y2, box.Z2));
+    sink        = err.has_value();
+  });
+
+  measure(name, "limit", [&] { sink = LandManager::ReachedLimit(playerFor(random(1, 1000))).has_value(); });
+
+  // A purchase in a fresh spot followed by selling it again, the index size stays constant
+  measure(name, "churn", [&] {
+    Mod::PlayerEntry player = playerFor(random(1, 1000));
+    LandBox box             = randomBox(world);
+
+    LandManager::Transaction trans;
+    LandManager::BuyLand(player, Vector3(box.X1, box.Y1, box.Z1), Vector3(box.X2, box.Y2, box.Z2));
+    trans.Commit();
+
+    sink = LandManager::SellLand(player, Vector3(box.X1, box.Y1, box.Z1)).empty();
+  });
+}
+
+// The world is kept out of the index and paged in from memory under a budget of a quarter of what it takes resident,
+// so most probes in cold tiles load one and evict the least recently used
+void paged(const World &world) {
+  generate(world);
+
+  int64_t resident = (int64_t) landIndex.Read()->Bytes() * 2;
+  std::map<std::pair<int32_t, int32_t>, std::vector<PagedLand>> stored;
+
+  for (const LandRecord &land : placed) {
+    RegionCache::Span span = RegionCache::Tiles(land.box);
+
+    if (span.Pinned()) {
+      stored[{RegionCache::kPinned, RegionCache::kPinned}].push_back({land, {}});
+      continue;
+    }
+
+    for (int32_t tx = span.X1; tx <= span.X2; tx++) {
+      for (int32_t tz = span.Z1; tz <= span.Z2; tz++) stored[{tx, tz}].push_back({land, {}});
+    }
+  }
+
+  landIndex.Write([](LandIndex &index) { index.Clear(); });
+
+  regions.Start(
+      [&](int dim, int32_t tx, int32_t tz, std::vector<PagedLand> &out) {
+        auto it = stored.find({tx, tz});
+        if (dim == 0 && it != stored.end()) out.insert(out.end(), it->second.begin(), it->second.end());
+      },
+      resident / 4);
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "%zu lands, budget 1/4", placed.size());
+
+  volatile bool sink = false;
+  measure(name, "paged", [&] { sink = LandManager::HasPerm(playerFor(random(1, 1000)), probe()); });
+
+  regions.Start(nullptr, 0);
+}
+
+// Every land pays monthly with deadlines spread over the month, each tick advances one second and schedules whatever
+// fired a month ahead, so the wheel stays as full as it started
+void rent(size_t lands) {
+  constexpr int64_t kMonth = 30 * 24 * 3600;
+
+  TimerWheel wheel;
+  int64_t now = 1700000000;
+  wheel.Reset(now);
+
+  for (size_t i = 0; i < lands; i++) wheel.Schedule((int64_t) i, now + random(0, (int) kMonth));
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "%zu leases", lands);
+
+  measure(name, "rent tick", [&] {
+    wheel.Advance(++now, [&](int64_t id, int64_t deadline) { wheel.Schedule(id, deadline + kMonth); });
+  });
+}
+
+// Towns of 64x64 split into sixteen plots owned by other players, each holding a shop trusted to one more. Checks go
+// three lands deep and explosions cover parts of several plots.
+void towns(size_t lands) {
+  placed.clear();
+  nextLandId = 1;
+
+  int side = (int) std::sqrt((double) lands / 33.0) + 1;
+  radius   = side * 40;
+
+  for (int t = 0; placed.size() < lands; t++) {
+    int x = (t % side) * 80 - radius;
+    int z = (t / side) * 80 - radius;
+
+    LandRecord town;
+    town.id    = LandManager::NextLandId();
+    town.owner = (uint64_t) random(1, 1000);
+    town.box   = LandBox(x, 40, z, x + 63, 200, z + 63);
+    placed.push_back(town);
+
+    for (int plot = 0; plot < 16; plot++) {
+      int px = x + plot % 4 * 16;
+      int pz = z + plot / 4 * 16;
+
+      LandRecord lot;
+      lot.id    = LandManager::NextLandId();
+      lot.owner = (uint64_t) random(1, 1000);
+      lot.depth = 1;
+      lot.box   = LandBox(px, 60, pz, px + 15, 120, pz + 15);
+      placed.push_back(lot);
+
+      LandRecord shop;
+      shop.id    = LandManager::NextLandId();
+      shop.owner = (uint64_t) random(1, 1000);
+      shop.depth = 2;
+      shop.box   = LandBox(px + 4, 64, pz + 4, px + 11, 80, pz + 11);
+      placed.push_back(shop);
+    }
+  }
+
+  landIndex.Write([](LandIndex &index) {
+    index.Clear();
+
+    for (const LandRecord &land : placed) {
+      index.Insert(land);
+      if (land.depth == 2) index.Trust(land.id, land.owner + 1);
+    }
+  });
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "%zu nested", placed.size());
+
+  volatile bool sink = false;
+
+  measure(name, "point", [&] {
+    const LandRecord &land = placed[random(0, (int) placed.size() - 1)];
+    sink                   = LandManager::HasPerm(playerFor(land.owner + random(0, 1)), pointInside(land));
+  });
+
+  measure(name, "blast", [&] {
+    const LandRecord &land = placed[random(0, (int) placed.size() - 1)];
+    Vector3 center         = pointInside(land);
+
+    LandBox box(center.X - 4, center.Y - 4, center.Z - 4, center.X + 4, center.Y + 4, center.Z + 4);
+    sink = LandManager::DeniedRegions(land.owner, 0, box).empty();
+  });
+}
+
+#if defined(__GLIBC__)
+size_t heapInUse() { return mallinfo2().uordblks; }
+#else
+size_t heapInUse() { return 0; }
+#endif
+
+// Heap taken by a fresh index holding the world, measured around the inserts where the allocator reports it and
+// always next to the index's own estimate
+void memory(const World &world) {
+  generate(world);
+
+  auto index    = std::make_unique<LandIndex>();
+  size_t before = heapInUse();
+
+  for (const LandRecord &land : placed) index->Insert(land);
+
+  size_t after    = heapInUse();
+  double perMil   = 1e6 / (double) placed.size() / (1024.0 * 1024.0);
+  double estimate = (double) index->Bytes() * perMil;
+
+  std::printf(
+      "\n%zu lands: estimate %.1f MB per million (%zu bytes per land)", placed.size(), estimate,
+      index->Bytes() / std::max<size_t>(placed.size(), 1));
+  if (after > before) {
+    std::printf(
+        ", measured %.1f MB per million (%zu bytes per land)", (double) (after - before) * perMil,
+        (after - before) / std::max<size_t>(placed.size(), 1));
+  }
+  std::printf("\n");
+}
+
+void parse(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!std::strcmp(argv[i], "--full")) {
+      options.full = true;
+    } else if (!std::strcmp(argv[i], "--ops") && i + 1 < argc) {
+      options.ops = std::strtoul(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--budget") && i + 1 < argc) {
+      options.budgetMs = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--kernel") && i + 1 < argc) {
+      std::string kernel = argv[++i];
+      options.kernel     = kernel == "avx512" ? LandSimd::Level::Avx512
+                         : kernel == "avx2"   ? LandSimd::Level::Avx2
+                                              : LandSimd::Level::Scalar;
+    } else if (!std::strcmp(argv[i], "--seed") && i + 1 < argc) {
+      options.seed = (uint32_t) std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      std::fprintf(
+          stderr, "usage: %s [--full] [--ops N] [--budget MS] [--seed N] [--kernel scalar|avx2|avx512]\n", argv[0]);
+      std::exit(1);
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  parse(argc, argv);
+
+  LandSimd::Select(options.kernel);
+  std::printf("kernel: %s\n", LandSimd::Name(LandSimd::Current()));
+
+  std::vector<size_t> sizes = {1000, 100000};
+  if (options.full) sizes.push_back(1000000);
+
+  std::printf("%-28s %-10s %12s %10s %10s\n", "world", "op", "ops/sec", "p50 ns", "p99 ns");
+
+  for (size_t lands : sizes) {
+    for (Layout layout : {Layout::Uniform, Layout::Clustered}) {
+      rng.seed(options.seed);
+      run({lands, layout, 4, 32});
+
+      rng.seed(options.seed);
+      run({lands, layout, 128, 1024});
+    }
+
+    rng.seed(options.seed);
+    run({lands, Layout::Dense, 4, 4});
+  }
+
+  for (size_t lands : sizes) {
+    rng.seed(options.seed);
+    rent(lands);
+  }
+
+  for (size_t lands : sizes) {
+    rng.seed(options.seed);
+    towns(lands);
+  }
+
+  rng.seed(options.seed);
+  paged({100000, Layout::Uniform, 4, 32});
+
+  rng.seed(options.seed);
+  memory({options.full ? 1000000u : 100000u, Layout::Uniform, 4, 32});
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Offline overlap audit of the lands table.
+//
+// Runs the same code as '/land audit' against a database file while the server is stopped, so a large world can be
+// checked and repaired on every core of another machine. The database is upgraded to the current schema first.
+// Usage: landaudit <database> <report.csv> [flag|oldest|shrink] [--threads N]
+
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "database.h"
+#include "session.h"
+#include "region.h"
+#include "audit.h"
+
+std::unique_ptr<SQLite::Database> landDB;
+SharedLandIndex landIndex;
+SessionTable sessions;
+RegionCache regions;
+
+namespace {
+
+struct Options {
+  std::string database;
+  std::string report;
+  AuditPolicy policy = AuditPolicy::Flag;
+  int threads        = 0;
+} options;
+
+bool parseArgs(int argc, char **argv) {
+  int positional = 0;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (arg == "--threads" && i + 1 < argc) {
+      options.threads = std::max(1, std::atoi(argv[++i]));
+    } else if (arg.compare(0, 2, "--") == 0) {
+      return false;
+    } else if (positional == 0) {
+      options.database = arg;
+      positional++;
+    } else if (positional == 1) {
+      options.report = arg;
+      positional++;
+    } else if (positional == 2 && arg == "flag") {
+      options.policy = AuditPolicy::Flag;
+      positional++;
+    } else if (positional == 2 && arg == "oldest") {
+      options.policy = AuditPolicy::Oldest;
+      positional++;
+    } else if (positional == 2 && arg == "shrink") {
+      options.policy = AuditPolicy::Shrink;
+      positional++;
+    } else {
+      return false;
+    }
+  }
+
+  return positional >= 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (!parseArgs(argc, argv)) {
+    std::fprintf(stderr, "usage: %s <database> <report.csv> [flag|oldest|shrink] [--threads N]\n", argv[0]);
+    return 2;
+  }
+
+  settings.database     = options.database;
+  settings.journal      = options.database + ".journal";
+  settings.snapshot     = options.database + ".snapshot";
+  settings.memoryBudget = 0;
+
+  AuditReport report;
+  std::optional<std::string> err;
+  double seconds = 0;
+
+  try {
+    LandManager::InitDatabase();
+
+    auto start = std::chrono::steady_clock::now();
+    err        = LandManager::AuditLands(options.report, options.policy, options.threads, report);
+    seconds    = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool saved = LandManager::FlushDatabase();
+    if (!saved && !err) err = "some changes were not saved, they are replayed on the next start";
+  } catch (SQLite::Exception const &ex) {
+    std::fprintf(stderr, "%s\n", ex.what());
+    return 1;
+  }
+
+  std::printf(
+      "audited %lld lands in %.2f s, %lld overlapping pairs, sold %lld, shrunk %lld\n", (long long) report.lands,
+      seconds, (long long) report.pairs, (long long) report.erased, (long long) report.shrunk);
+
+  if (err) {
+    std::fprintf(stderr, "%s\n", err->c_str());
+    return 1;
+  }
+
+  return report.pairs && options.policy == AuditPolicy::Flag ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+// Replays audit traffic recorded with the trace setting through the land engine.
+//
+// Loads the lands from a copy of the server database and pages in every region the trace touches, so page-ins are
+// not timed. Then it feeds the records through the permission check as fast as it can and reports throughput, the
+// latency distribution and every answer that differs from the recorded one. With one thread each check goes through
+// CheckPerm and its per-player cache like the hooks do. With more, the records are split by player and checked with
+// HasPerm. --out writes the trace back with this build's answers, replaying that file with another build diffs the
+// two builds against each other.
+// Usage: landreplay <database> <trace>... [--threads N] [--out FILE] [--diffs N]
+
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_set>
+
+#include "database.h"
+#include "session.h"
+#include "region.h"
+#include "stats.h"
+#include "trace.h"
+
+std::unique_ptr<SQLite::Database> landDB;
+SharedLandIndex landIndex;
+SessionTable sessions;
+RegionCache regions;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string database;
+  std::vector<std::string> traces;
+  std::string out;
+  int threads  = 1;
+  size_t diffs = 10;
+} options;
+
+bool parseArgs(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (arg == "--threads" && i + 1 < argc) {
+      options.threads = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--out" && i + 1 < argc) {
+      options.out = argv[++i];
+    } else if (arg == "--diffs" && i + 1 < argc) {
+      options.diffs = (size_t) std::atoll(argv[++i]);
+    } else if (arg.compare(0, 2, "--") == 0) {
+      return false;
+    } else if (options.database.empty()) {
+      options.database = arg;
+    } else {
+      options.traces.push_back(arg);
+    }
+  }
+
+  return !options.database.empty() && !options.traces.empty();
+}
+
+inline uint64_t elapsed(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+inline Vector3 pointOf(const TraceRecord &rec) { return Vector3(rec.x, rec.y, rec.z, rec.dim); }
+
+void replaySerial(const std::vector<TraceRecord> &records, std::vector<uint8_t> &answers, LatencyHistogram &latency) {
+  for (size_t i = 0; i < records.size(); i++) {
+    Mod::PlayerEntry player{nullptr, "", records[i].xuid};
+    auto start = Clock::now();
+
+    answers[i] = LandManager::CheckPerm(player, pointOf(records[i]));
+    latency.Record(elapsed(start));
+  }
+}
+
+// Every player's checks stay on one thread and in order, each thread keeps its own histogram
+void replayParallel(const std::vector<TraceRecord> &records, std::vector<uint8_t> &answers, LatencyHistogram &latency) {
+  std::vector<std::vector<size_t>> shares(options.threads);
+  std::vector<LatencyHistogram> local(options.threads);
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < records.size(); i++) {
+    shares[std::hash<uint64_t>()(records[i].xuid) % options.threads].push_back(i);
+  }
+
+  for (int t = 0; t < options.threads; t++) {
+    threads.emplace_back([&, t] {
+      for (size_t i : shares[t]) {
+        Mod::PlayerEntry player{nullptr, "", records[i].xuid};
+        auto start = Clock::now();
+
+        answers[i] = LandManager::HasPerm(player, pointOf(records[i]));
+        local[t].Record(elapsed(start));
+      }
+    });
+  }
+
+  for (std::thread &thread : threads) thread.join();
+  for (const LatencyHistogram &histogram : local) latency.Merge(histogram);
+}
+
+const char *sourceName(TraceSource source) {
+  switch (source) {
+  case TraceSource::Action: return "action";
+  case TraceSource::Transaction: return "item use";
+  default: return "actor use";
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (!parseArgs(argc, argv)) {
+    std::fprintf(stderr, "usage: %s <database> <trace>... [--threads N] [--out FILE] [--diffs N]\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<TraceRecord> records;
+
+  for (const std::string &trace : options.traces) {
+    if (!TraceRecorder::Read(trace, records)) {
+      std::fprintf(stderr, "%s is missing or not a land trace\n", trace.c_str());
+      return 2;
+    }
+  }
+
+  if (records.empty()) {
+    std::fprintf(stderr, "the traces hold no records\n");
+    return 2;
+  }
+
+  settings.database     = options.database;
+  settings.journal      = options.database + ".journal";
+  settings.snapshot     = options.database + ".snapshot";
+  settings.memoryBudget = 0;
+
+  try {
+    LandManager::InitDatabase();
+  } catch (SQLite::Exception const &ex) {
+    std::fprintf(stderr, "%s\n", ex.what());
+    return 2;
+  }
+
+  // Load every region the trace reaches, then stop paging so only the checks themselves are timed
+  for (const TraceRecord &rec : records) regions.Ensure(rec.dim, rec.x, rec.y, rec.z);
+  regions.Start(nullptr, 0);
+
+  std::vector<uint8_t> answers(records.size());
+  LatencyHistogram latency;
+
+  auto start = Clock::now();
+  if (options.threads == 1) {
+    replaySerial(records, answers, latency);
+  } else {
+    replayParallel(records, answers, latency);
+  }
+  double seconds = elapsed(start) / 1e9;
+
+  std::unordered_set<uint64_t> players;
+  for (const TraceRecord &rec : records) players.insert(rec.xuid);
+
+  double span = (records.back().time - records.front().time) / 1e6;
+
+  std::printf(
+      "%zu checks from %zu players, %.1f s of traffic\n", records.size(), players.size(), span > 0 ? span : 0.0);
+  std::printf(
+      "%d thread%s: %.3f s, %.0f checks/s, %.0fx real time\n", options.threads, options.threads > 1 ? "s" : "",
+      seconds, records.size() / seconds, span > 0 ? span / seconds : 0.0);
+  std::printf(
+      "latency ns: mean %llu  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+      (unsigned long long) latency.Mean(), (unsigned long long) latency.Percentile(0.5),
+      (unsigned long long) latency.Percentile(0.9), (unsigned long long) latency.Percentile(0.99),
+      (unsigned long long) latency.Percentile(0.999), (unsigned long long) latency.Percentile(1.0));
+
+  size_t nowDenied = 0, nowAllowed = 0;
+
+  for (size_t i = 0; i < records.size(); i++) {
+    const TraceRecord &rec = records[i];
+    if (answers[i] == rec.allowed) continue;
+
+    (rec.allowed ? nowDenied : nowAllowed)++;
+
+    if (nowDenied + nowAllowed <= options.diffs) {
+      std::printf(
+          "  diff at %.3f s: xuid %llu %s #%d dim %d (%d, %d, %d) recorded %s, replayed %s\n", rec.time / 1e6,
+          (unsigned long long) rec.xuid, sourceName(rec.source), rec.kind, rec.dim, rec.x, rec.y, rec.z,
+          rec.allowed ? "allowed" : "denied", answers[i] ? "allowed" : "denied");
+    }
+  }
+
+  std::printf("diffs: %zu now denied, %zu now allowed\n", nowDenied, nowAllowed);
+
+  if (!options.out.empty()) {
+    std::vector<TraceRecord> replayed = records;
+    for (size_t i = 0; i < replayed.size(); i++) replayed[i].allowed = answers[i];
+
+    if (!TraceRecorder::Write(options.out, replayed)) {
+      std::fprintf(stderr, "failed to write %s\n", options.out.c_str());
+    }
+  }
+
+  LandManager::FlushDatabase();
+  return nowDenied + nowAllowed ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+// Offline import and export of the lands table.
+//
+// Runs the same code as '/land import' and '/land export' against a database file while the server is stopped, so
+// claims can be migrated or backed up without it. The database is upgraded to the current schema first.
+// Usage: landtransfer <database> import|export <file.csv>
+
+#include <cstdio>
+#include <cstring>
+
+#include "database.h"
+#include "session.h"
+#include "region.h"
+#include "transfer.h"
+
+std::unique_ptr<SQLite::Database> landDB;
+SharedLandIndex landIndex;
+SessionTable sessions;
+RegionCache regions;
+
+int main(int argc, char **argv) {
+  if (argc != 4 || (std::strcmp(argv[2], "import") != 0 && std::strcmp(argv[2], "export") != 0)) {
+    std::fprintf(stderr, "usage: %s <database> import|export <file.csv>\n", argv[0]);
+    return 2;
+  }
+
+  std::string database = argv[1];
+  bool importing       = std::strcmp(argv[2], "import") == 0;
+
+  settings.database = database;
+  settings.journal  = database + ".journal";
+  settings.snapshot = database + ".snapshot";
+
+  TransferReport report;
+  std::optional<std::string> err;
+
+  try {
+    LandManager::InitDatabase();
+
+    err = importing ? LandManager::ImportLands(argv[3], report) : LandManager::ExportLands(argv[3], report);
+
+    bool saved = LandManager::FlushDatabase();
+    if (!saved && !err) err = "some changes were not saved, they are replayed on the next start";
+  } catch (SQLite::Exception const &ex) {
+    std::fprintf(stderr, "%s\n", ex.what());
+    return 1;
+  }
+
+  std::printf(
+      "%s %lld lands, %lld trusts, %lld rows skipped", importing ? "imported" : "exported", (long long) report.lands,
+      (long long) report.trusts, (long long) report.skipped);
+  if (report.skipped) std::printf(" (first on line %lld)", (long long) report.firstSkipped);
+  std::printf("\n");
+
+  if (err) {
+    std::fprintf(stderr, "%s\n", err->c_str());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,188 @@
+// Export and import round trip of nested lands, run by ctest.
+//
+// Claims lands nested three deep, a sub-zone given to another player, trusted players and a pinned land with one
+// nested in it, exports them, clears the table and imports the file back. The lands must come back the same, depth
+// included, and again from a copy of the file with every child listed before its parent.
+// Usage: landroundtrip [database]
+
+#include <set>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <algorithm>
+
+#include "database.h"
+#include "session.h"
+#include "region.h"
+#include "transfer.h"
+
+std::unique_ptr<SQLite::Database> landDB;
+SharedLandIndex landIndex;
+SessionTable sessions;
+RegionCache regions;
+
+namespace {
+
+constexpr std::chrono::milliseconds kWriterTimeout = std::chrono::seconds(30);
+
+Mod::PlayerEntry playerFor(uint64_t xuid) {
+  Mod::PlayerEntry player;
+  player.name = "p" + std::to_string(xuid);
+  player.xuid = xuid;
+  return player;
+}
+
+bool buy(uint64_t owner, Vector3 start, Vector3 end) {
+  auto player = playerFor(owner);
+  auto err    = LandManager::Overlaps(player, start, end);
+
+  if (!err) err = LandManager::BuyLand(player, start, end);
+  if (err) std::printf("could not claim a land: %s\n", err->c_str());
+  return !err;
+}
+
+bool claim() {
+  bool ok = buy(1, Vector3(0, 0, 0), Vector3(99, 99, 99)) && buy(1, Vector3(10, 10, 10), Vector3(40, 40, 40)) &&
+            buy(1, Vector3(20, 20, 20), Vector3(30, 30, 30)) && buy(1, Vector3(60, 0, 60), Vector3(80, 50, 80)) &&
+            buy(3, Vector3(1000, 0, 1000, 1), Vector3(1010, 10, 1010, 1)) &&
+            buy(4, Vector3(-20000, 0, 20000), Vector3(20000, 3, 20010)) &&
+            buy(4, Vector3(-100, 0, 20001), Vector3(100, 2, 20005));
+
+  if (!ok) return false;
+
+  LandManager::TrustPlayer(playerFor(1), playerFor(5), Vector3(25, 25, 25));
+  LandManager::GiveLand(playerFor(1), playerFor(2), Vector3(70, 10, 70));
+  LandManager::TrustPlayer(playerFor(3), playerFor(6), Vector3(1005, 5, 1005, 1));
+  LandManager::TrustPlayer(playerFor(3), playerFor(7), Vector3(1005, 5, 1005, 1));
+  return true;
+}
+
+void eraseAll() {
+  LandManager::WaitForWriter(0, kWriterTimeout);
+
+  SQLite::Statement stmt{*landDB, "SELECT id FROM lands"};
+  LandManager::Transaction trans;
+
+  while (stmt.executeStep()) {
+    LandMutation erase;
+    erase.kind    = LandMutation::Kind::Erase;
+    erase.land.id = stmt.getColumn(0).getInt64();
+    LandManager::Submit(erase);
+  }
+
+  trans.Commit();
+  LandManager::WaitForWriter(0, kWriterTimeout);
+}
+
+// Rows without their id, which an import does not keep, and with the trusted players sorted
+std::multiset<std::string> lands(const std::string &path) {
+  std::multiset<std::string> rows;
+  std::ifstream file(path);
+
+  for (std::string line; std::getline(file, line);) {
+    if (line.compare(0, 2, "id") == 0) continue;
+
+    size_t trusted = line.rfind(',');
+    std::istringstream xuids(line.substr(trusted + 1));
+    std::vector<std::string> sorted{std::istream_iterator<std::string>(xuids), std::istream_iterator<std::string>()};
+
+    std::sort(sorted.begin(), sorted.end());
+    std::string row = line.substr(line.find(',') + 1, trusted - line.find(','));
+    for (const std::string &xuid : sorted) row += xuid + " ";
+
+    rows.insert(row);
+  }
+
+  return rows;
+}
+
+bool roundTrip(const std::string &from, const std::string &to, const std::multiset<std::string> &expected) {
+  TransferReport imported, exported;
+
+  eraseAll();
+  auto err = LandManager::ImportLands(from, imported);
+
+  if (!err) {
+    LandManager::WaitForWriter(0, kWriterTimeout);
+    err = LandManager::ExportLands(to, exported);
+  }
+
+  if (err) {
+    std::printf("%s: %s\n", from.c_str(), err->c_str());
+    return false;
+  }
+
+  bool same = lands(to) == expected && imported.skipped == 0;
+
+  std::printf(
+      "%-28s %4lld lands %4lld trusts %4lld skipped  %s\n", from.c_str(), (long long) imported.lands,
+      (long long) imported.trusts, (long long) imported.skipped, same ? "same" : "DIFFERENT");
+  return same;
+}
+
+void removeDatabase(const std::string &path) {
+  for (const char *suffix : {"", "-wal", "-shm", ".journal", ".journal.1", ".snapshot"}) {
+    std::remove((path + suffix).c_str());
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string database = argc > 1 ? argv[1] : "landroundtrip.db";
+  std::string exported = database + ".csv";
+  std::string reversed = database + ".reversed.csv";
+
+  removeDatabase(database);
+  settings.database = database;
+  settings.journal  = database + ".journal";
+  settings.snapshot = database + ".snapshot";
+  settings.limit    = 100;
+
+  bool ok = false;
+
+  try {
+    LandManager::InitDatabase();
+
+    TransferReport report;
+    ok = claim();
+    LandManager::WaitForWriter(0, kWriterTimeout);
+    ok = ok && !LandManager::ExportLands(exported, report);
+
+    std::multiset<std::string> expected = lands(exported);
+
+    // Depths 0 to 2 are all there, or the round trip proves little
+    int nested = 0;
+
+    for (const std::string &row : expected) {
+      std::istringstream fields(row);
+      std::string depth;
+      for (int i = 0; i < 9; i++) std::getline(fields, depth, ',');
+      nested += depth == "2";
+    }
+
+    ok = ok && expected.size() == 7 && nested == 1;
+
+    // Children first, as a hand-edited file might have them
+    {
+      std::ifstream in(exported);
+      std::vector<std::string> lines;
+      for (std::string line; std::getline(in, line);) lines.push_back(line);
+
+      std::ofstream out(reversed);
+      out << lines[0] << "\n";
+      for (size_t i = lines.size() - 1; i > 0; i--) out << lines[i] << "\n";
+    }
+
+    ok = roundTrip(exported, database + ".again.csv", expected) && ok;
+    ok = roundTrip(reversed, database + ".again.csv", expected) && ok;
+    ok = LandManager::FlushDatabase() && ok;
+  } catch (SQLite::Exception const &ex) {
+    std::printf("%s\n", ex.what());
+    ok = false;
+  }
+
+  std::printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
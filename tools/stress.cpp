@@ -0,0 +1,267 @@
+// Concurrency check for the land index, run by ctest.
+//
+// Reader threads look up lands the writer never touches while it buys and sells elsewhere, every lookup must still
+// find its land and keep strangers out. It runs once with every land resident and once paged in from memory under a
+// budget of a quarter of the world, so the readers also race the pager loading and evicting tiles under them.
+// Usage: landstress [--budget MS] [--seed N] [--readers N] [--lands N]
+
+#include <map>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "settings.h"
+#include "session.h"
+#include "region.h"
+#include "stats.h"
+#include "landmanager.h"
+
+SharedLandIndex landIndex;
+SessionTable sessions;
+RegionCache regions;
+
+// Stand-ins for persistence.cpp, mutations are applied to the index directly instead of being queued for SQLite
+
+namespace {
+thread_local LandManager::Transaction *current = nullptr;
+std::atomic<int64_t> nextLandId{1};
+} // namespace
+
+int64_t LandManager::NextLandId() { return nextLandId++; }
+
+void LandManager::Submit(const LandMutation &mutation) {
+  if (current) {
+    current->staged.push_back(mutation);
+    return;
+  }
+
+  landIndex.Apply(mutation);
+}
+
+LandManager::Transaction::Transaction() : outer(current) { current = this; }
+
+LandManager::Transaction::~Transaction() {
+  if (current == this) current = outer;
+}
+
+void LandManager::Transaction::Commit() {
+  current = outer;
+  for (const LandMutation &mutation : staged) Submit(mutation);
+  staged.clear();
+}
+
+Vector3 getChunk(Vector3 vec) { return Vector3(vec.X >> 4, vec.Y >> 4, vec.Z >> 4); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  int budgetMs  = 1000;
+  uint32_t seed = 1;
+  int readers   = 4;
+  size_t lands  = 20000;
+} options;
+
+std::mt19937 rng;
+std::vector<LandRecord> placed;
+int radius = 0;
+
+int random(int min, int max) { return std::uniform_int_distribution<int>(min, max)(rng); }
+
+LandBox randomBox() {
+  int x = random(-radius, radius);
+  int z = random(-radius, radius);
+  int y = random(0, 200);
+
+  return LandBox(x, y, z, x + random(4, 32) - 1, y + random(8, 64), z + random(4, 32) - 1);
+}
+
+Mod::PlayerEntry playerFor(uint64_t xuid) {
+  Mod::PlayerEntry player;
+  player.xuid = xuid;
+  return player;
+}
+
+// Lands never overlap in a real world, so placements that would are retried elsewhere. The world spans a few hundred
+// tiles, enough for the paged run to keep evicting.
+void generate() {
+  LandIndex scratch;
+
+  placed.clear();
+  radius = (int) (std::sqrt((double) options.lands) * 36.0);
+
+  size_t attempts = 0;
+
+  while (placed.size() < options.lands && attempts++ < options.lands * 8) {
+    LandBox box   = randomBox();
+    bool overlaps = false;
+
+    scratch.Overlapping(0, box, [&](const LandRecord &) {
+      overlaps = true;
+      return false;
+    });
+
+    if (overlaps) continue;
+
+    LandRecord land;
+    land.id    = LandManager::NextLandId();
+    land.owner = (uint64_t) random(1, (int) std::max<size_t>(options.lands / 3, 1));
+    land.box   = box;
+
+    scratch.Insert(land);
+    placed.push_back(land);
+  }
+}
+
+// Returns false if any reader saw a lookup miss its land or let a stranger in
+bool race(const char *name) {
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> reads{0}, failures{0};
+  std::vector<std::thread> threads;
+
+  const size_t stable  = placed.size();
+  const auto stranger  = playerFor(UINT64_MAX);
+  const int64_t lastId = nextLandId.load() - 1;
+
+  for (int t = 0; t < options.readers; t++) {
+    threads.emplace_back([&, t] {
+      std::mt19937 local(options.seed + t);
+      uint64_t count = 0;
+
+      while (!done.load(std::memory_order_relaxed)) {
+        const LandRecord &land = placed[std::uniform_int_distribution<size_t>(0, stable - 1)(local)];
+        Vector3 point(land.box.X1, land.box.Y1, land.box.Z1);
+
+        std::vector<int64_t> ids = findStandingLand(playerFor(land.owner), point);
+        bool found               = std::find(ids.begin(), ids.end(), land.id) != ids.end();
+
+        if (!found || LandManager::HasPerm(stranger, point)) failures.fetch_add(1, std::memory_order_relaxed);
+        count++;
+      }
+
+      reads.fetch_add(count, std::memory_order_relaxed);
+    });
+  }
+
+  auto start      = Clock::now();
+  auto deadline   = start + std::chrono::milliseconds(options.budgetMs);
+  uint64_t writes = 0;
+
+  while (Clock::now() < deadline) {
+    Mod::PlayerEntry player = playerFor(random(1, 1000));
+    LandBox box             = randomBox();
+
+    LandManager::BuyLand(player, Vector3(box.X1, box.Y1, box.Z1), Vector3(box.X2, box.Y2, box.Z2));
+
+    // Sell the land we just bought, not an older one of the same owner that happens to cover the corner
+    LandMutation sell;
+    sell.kind    = LandMutation::Kind::Erase;
+    sell.land.id = lastId + (int64_t) ++writes;
+    LandManager::Submit(sell);
+  }
+
+  done = true;
+  for (std::thread &thread : threads) thread.join();
+
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::printf(
+      "%-28s %12.0f reads/s %12.0f writes/s %8llu failures\n", name, reads.load() / seconds, 2 * writes / seconds,
+      (unsigned long long) failures.load());
+
+  return failures.load() == 0;
+}
+
+bool resident() {
+  landIndex.Write([](LandIndex &index) {
+    index.Clear();
+    for (const LandRecord &land : placed) index.Insert(land);
+  });
+
+  return race("resident");
+}
+
+// The loader only knows the generated world, lands the writer bought are gone for good once their tile is evicted.
+// Readers never look for those.
+bool paged() {
+  landIndex.Write([](LandIndex &index) {
+    index.Clear();
+    for (const LandRecord &land : placed) index.Insert(land);
+  });
+
+  int64_t budget = (int64_t) landIndex.Read()->Bytes() * 2 / 4;
+  std::map<std::pair<int32_t, int32_t>, std::vector<PagedLand>> stored;
+
+  for (const LandRecord &land : placed) {
+    RegionCache::Span span = RegionCache::Tiles(land.box);
+
+    if (span.Pinned()) {
+      stored[{RegionCache::kPinned, RegionCache::kPinned}].push_back({land, {}});
+      continue;
+    }
+
+    for (int32_t tx = span.X1; tx <= span.X2; tx++) {
+      for (int32_t tz = span.Z1; tz <= span.Z2; tz++) stored[{tx, tz}].push_back({land, {}});
+    }
+  }
+
+  landIndex.Write([](LandIndex &index) { index.Clear(); });
+
+  regions.Start(
+      [&](int dim, int32_t tx, int32_t tz, std::vector<PagedLand> &out) {
+        auto it = stored.find({tx, tz});
+        if (dim == 0 && it != stored.end()) out.insert(out.end(), it->second.begin(), it->second.end());
+      },
+      budget);
+
+  uint64_t evicted = landStats.evictedTiles.load();
+  bool ok          = race("paged, budget 1/4");
+
+  evicted = landStats.evictedTiles.load() - evicted;
+  std::printf("%-28s %12zu tiles resident %8llu evicted\n", "", regions.Resident(), (unsigned long long) evicted);
+
+  regions.Start(nullptr, 0);
+
+  // A run that never evicted did not race the pager at all
+  if (evicted == 0) std::printf("the paged run never evicted a tile\n");
+  return ok && evicted > 0;
+}
+
+void parse(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!std::strcmp(argv[i], "--budget") && i + 1 < argc) {
+      options.budgetMs = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--seed") && i + 1 < argc) {
+      options.seed = (uint32_t) std::strtoul(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--readers") && i + 1 < argc) {
+      options.readers = std::max(1, std::atoi(argv[++i]));
+    } else if (!std::strcmp(argv[i], "--lands") && i + 1 < argc) {
+      options.lands = std::max<size_t>(100, std::strtoul(argv[++i], nullptr, 10));
+    } else {
+      std::fprintf(stderr, "usage: %s [--budget MS] [--seed N] [--readers N] [--lands N]\n", argv[0]);
+      std::exit(2);
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  parse(argc, argv);
+
+  rng.seed(options.seed);
+  generate();
+
+  bool ok = resident();
+  ok      = paged() && ok;
+
+  std::printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// Stand-in for the mod SDK logger, messages are dropped
+
+struct NullLog {
+  template <typename T> inline NullLog &operator%(const T &) { return *this; }
+};
+
+#define DEF_LOGGER(name) static_assert(true, name)
+#define LOGV(fmt) NullLog()
+#define LOGI(fmt) NullLog()
+#define LOGW(fmt) NullLog()
+#define LOGE(fmt) NullLog()
@@ -0,0 +1,27 @@
+#pragma once
+
+// Stand-in for the mod SDK player database, just enough for the land logic to build outside the server
+
+#include <string>
+#include <cstdint>
+#include <optional>
+
+class Player {};
+
+namespace Mod {
+struct PlayerEntry {
+  Player *player = nullptr;
+  std::string name;
+  uint64_t xuid = 0;
+};
+
+class PlayerDatabase {
+public:
+  static inline PlayerDatabase &GetInstance() {
+    static PlayerDatabase instance;
+    return instance;
+  }
+
+  inline std::optional<PlayerEntry> Find(Player *) { return {}; }
+};
+} // namespace Mod
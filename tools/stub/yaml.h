@@ -0,0 +1,9 @@
+#pragma once
+
+// Stand-in for the mod SDK yaml header, only what Settings::io needs to compile
+
+namespace YAML {
+struct Node {
+  inline Node operator[](const char *) { return {}; }
+};
+} // namespace YAML
@@ -0,0 +1,158 @@
+#include "trace.h"
+
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "stats.h"
+
+static_assert(sizeof(TraceRecord) == 32, "trace records must stay fixed size");
+
+namespace {
+
+const char kMagic[8] = {'L', 'M', 'T', 'R', 'A', 'C', 'E', 0};
+
+uint64_t micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+TraceRecorder::~TraceRecorder() { Stop(); }
+
+bool TraceRecorder::Start(const std::string &path, int64_t maxBytes) {
+  Stop();
+
+  this->path     = path;
+  this->maxBytes = maxBytes;
+  started        = micros();
+
+  if (!open()) return false;
+
+  running = true;
+  writer  = std::thread(&TraceRecorder::writerLoop, this);
+  return true;
+}
+
+void TraceRecorder::Stop() {
+  {
+    std::lock_guard lock(mutex);
+    if (!running) return;
+    running = false;
+  }
+
+  wake.notify_one();
+  writer.join();
+
+  // Whatever the hooks recorded before stopping still goes to the file
+  drain();
+  std::fclose(file);
+  file = nullptr;
+}
+
+void TraceRecorder::Record(TraceSource source, int kind, uint64_t xuid, int dim, int x, int y, int z, bool allowed) {
+  uint64_t at = head.load(std::memory_order_relaxed);
+
+  if (at - tail.load(std::memory_order_acquire) >= kCapacity) {
+    landStats.droppedEvents.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  TraceRecord &rec = ring[at & (kCapacity - 1)];
+  rec.xuid         = xuid;
+  rec.time         = micros() - started;
+  rec.x            = x;
+  rec.y            = y;
+  rec.z            = z;
+  rec.source       = source;
+  rec.kind         = (uint8_t) kind;
+  rec.dim          = (uint8_t) dim;
+  rec.allowed      = allowed;
+
+  head.store(at + 1, std::memory_order_release);
+  landStats.tracedEvents.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool TraceRecorder::Read(const std::string &path, std::vector<TraceRecord> &out) {
+  std::FILE *in = std::fopen(path.c_str(), "rb");
+  if (!in) return false;
+
+  Header header;
+  bool valid = std::fread(&header, sizeof(header), 1, in) == 1 && !std::memcmp(header.magic, kMagic, 8) &&
+               header.version == kVersion && header.recordSize == sizeof(TraceRecord);
+
+  // A torn last record is left out, the recorder only ever appends whole ones
+  TraceRecord rec;
+  while (valid && std::fread(&rec, sizeof(rec), 1, in) == 1) out.push_back(rec);
+
+  std::fclose(in);
+  return valid;
+}
+
+bool TraceRecorder::Write(const std::string &path, const std::vector<TraceRecord> &records) {
+  std::FILE *out = create(path);
+  if (!out) return false;
+
+  size_t count = records.empty() ? 0 : std::fwrite(records.data(), sizeof(TraceRecord), records.size(), out);
+  return std::fclose(out) == 0 && count == records.size();
+}
+
+// Opens a new trace file with its header
+std::FILE *TraceRecorder::create(const std::string &path) {
+  std::FILE *out = std::fopen(path.c_str(), "wb");
+  if (!out) return nullptr;
+
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version    = kVersion;
+  header.recordSize = sizeof(TraceRecord);
+
+  std::fwrite(&header, sizeof(header), 1, out);
+  return out;
+}
+
+bool TraceRecorder::open() {
+  file    = create(path);
+  written = sizeof(Header);
+  return file != nullptr;
+}
+
+void TraceRecorder::drain() {
+  uint64_t from = tail.load(std::memory_order_relaxed);
+  uint64_t to   = head.load(std::memory_order_acquire);
+
+  while (file && from < to) {
+    // The ring wraps, so this takes up to two writes
+    size_t first = from & (kCapacity - 1);
+    size_t count = std::min<uint64_t>(to - from, kCapacity - first);
+
+    std::fwrite(&ring[first], sizeof(TraceRecord), count, file);
+    written += count * sizeof(TraceRecord);
+    from += count;
+    tail.store(from, std::memory_order_release);
+
+    if (maxBytes > 0 && written >= maxBytes) {
+      std::fclose(file);
+
+      std::error_code error;
+      std::filesystem::rename(path, path + ".1", error);
+      open();
+    }
+  }
+
+  if (file) std::fflush(file);
+}
+
+void TraceRecorder::writerLoop() {
+  std::unique_lock lock(mutex);
+
+  while (running) {
+    wake.wait_for(lock, std::chrono::milliseconds(100), [this] { return !running; });
+
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+}
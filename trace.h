@@ -0,0 +1,82 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <condition_variable>
+
+enum class TraceSource : uint8_t { Action, Transaction, ActorUse };
+
+// One permission check made by an audit hook. kind is the PlayerActionType, ItemUseInventoryTransaction::Type or
+// ItemUseOnActorInventoryTransaction::Type, allowed is what CheckPerm answered.
+struct TraceRecord {
+  uint64_t xuid;
+  uint64_t time; // Microseconds since recording started
+  int32_t x, y, z;
+  TraceSource source;
+  uint8_t kind;
+  uint8_t dim;
+  uint8_t allowed;
+};
+
+// Records audit traffic to a binary log for offline replay.
+//
+// The hooks copy each record into a fixed ring in memory and return, a background thread drains it to the file. A
+// record that finds the ring full is dropped and counted instead of waiting. Once the file reaches the size limit it
+// is renamed to <path>.1, replacing the previous one, and a new file is started, so at most twice the limit is kept.
+// Every file starts with a small header and holds whole records after it.
+class TraceRecorder {
+public:
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kCapacity  = 1 << 16;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+  };
+
+  ~TraceRecorder();
+
+  bool Start(const std::string &path, int64_t maxBytes);
+  void Stop();
+
+  inline bool Enabled() const { return running.load(std::memory_order_relaxed); }
+
+  // Only from the server thread, there is a single producer
+  void Record(TraceSource source, int kind, uint64_t xuid, int dim, int x, int y, int z, bool allowed);
+
+  // Appends every record of a trace file, false if it is missing or not a trace
+  static bool Read(const std::string &path, std::vector<TraceRecord> &out);
+
+  // Writes records as a single trace file
+  static bool Write(const std::string &path, const std::vector<TraceRecord> &records);
+
+private:
+  static std::FILE *create(const std::string &path);
+
+  bool open();
+  void drain();
+  void writerLoop();
+
+  std::string path;
+  int64_t maxBytes = 0;
+  int64_t written  = 0;
+  std::FILE *file  = nullptr;
+  uint64_t started = 0;
+
+  TraceRecord ring[kCapacity];
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+
+  std::atomic<bool> running{false};
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread writer;
+};
+
+extern TraceRecorder tracer;
@@ -0,0 +1,238 @@
+#include "transfer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include "database.h"
+#include "region.h"
+
+DEF_LOGGER("LandManager");
+
+namespace {
+
+// Lands claimed per transaction, the writer commits them in batches of the same size
+constexpr size_t kBatchLands = 512;
+
+// Lands the writer may fall behind by before an import waits for it
+constexpr size_t kMaxBacklog = 4096;
+
+constexpr std::chrono::milliseconds kWriterTimeout = std::chrono::seconds(30);
+
+struct Row {
+  LandRecord land;
+  std::vector<uint64_t> trusted;
+
+  // Depth the file gives, only decides in which pass the row is claimed
+  int32_t level = 0;
+};
+
+bool readNumber(const char *&it, int64_t &value) {
+  char *end;
+  errno = 0;
+  value = std::strtoll(it, &end, 10);
+
+  if (end == it || errno == ERANGE) return false;
+  it = end;
+  return true;
+}
+
+bool parseRow(const std::string &line, bool depths, Row &row) {
+  const char *it = line.c_str();
+  int64_t fields[10] = {};
+  int count          = depths ? 10 : 9;
+
+  for (int i = 0; i < count; i++) {
+    if (i > 0 && *it++ != ',') return false;
+    if (!readNumber(it, fields[i])) return false;
+  }
+
+  if (*it == ',') {
+    it++;
+
+    while (*it == ' ') it++;
+    while (*it && *it != '\r') {
+      int64_t xuid;
+      if (!readNumber(it, xuid)) return false;
+
+      row.trusted.push_back(xuid);
+      while (*it == ' ') it++;
+    }
+  }
+
+  if (*it && *it != '\r') return false;
+
+  for (int i = 3; i < 9; i++) {
+    if (fields[i] < INT32_MIN || fields[i] > INT32_MAX) return false;
+  }
+
+  if (fields[1] == 0 || fields[2] < 0 || fields[2] >= LandIndex::kDimensions) return false;
+  if (fields[9] < 0 || fields[9] > LandIndex::kMaxDepth) return false;
+
+  row.land.owner = fields[1];
+  row.land.dim   = (int32_t) fields[2];
+  row.land.box   = LandBox(fields[3], fields[4], fields[5], fields[6], fields[7], fields[8]);
+  row.level      = (int32_t) fields[9];
+  return true;
+}
+
+// Nests the row in the deepest land holding it whole, false if a land cuts into it without holding it or nesting it
+// would go too deep. Rows of the batch are not in the index yet, they are checked one by one.
+bool place(Row &row, const std::vector<Row> &batch) {
+  const LandRecord &land = row.land;
+  int32_t parent         = -1;
+  bool fits              = true;
+
+  auto check = [&](const LandRecord &other) {
+    fits   = other.box.Contains(land.box);
+    parent = std::max(parent, other.depth);
+    return fits;
+  };
+
+  for (size_t i = 0; i < batch.size() && fits; i++) {
+    if (batch[i].land.dim == land.dim && batch[i].land.box.Intersects(land.box)) check(batch[i].land);
+  }
+
+  if (fits) regions.Read(land.dim, land.box)->Overlapping(land.dim, land.box, check);
+  if (!fits || parent >= LandIndex::kMaxDepth) return false;
+
+  row.land.depth = parent + 1;
+  return true;
+}
+
+void claim(std::vector<Row> &batch, TransferReport &report) {
+  LandManager::Transaction trans;
+
+  for (const Row &row : batch) {
+    LandMutation insert;
+    insert.kind    = LandMutation::Kind::Insert;
+    insert.land    = row.land;
+    insert.land.id = LandManager::NextLandId();
+
+    LandManager::Submit(insert);
+    report.lands++;
+
+    for (uint64_t xuid : row.trusted) {
+      LandMutation trust;
+      trust.kind    = LandMutation::Kind::Trust;
+      trust.land.id = insert.land.id;
+      trust.player  = xuid;
+
+      LandManager::Submit(trust);
+      report.trusts++;
+    }
+  }
+
+  trans.Commit();
+  batch.clear();
+}
+
+} // namespace
+
+std::optional<std::string> LandManager::ImportLands(const std::string &path, TransferReport &report) {
+  std::ifstream file(path);
+  if (!file) return "[Zonas] No se pudo abrir el archivo " + path + ".";
+
+  std::vector<Row> batch;
+  std::string line;
+  int32_t deepest = 0;
+  bool depths     = true;
+
+  batch.reserve(kBatchLands);
+
+  auto skip = [&](int64_t number) {
+    if (!report.skipped++ || number < report.firstSkipped) report.firstSkipped = number;
+  };
+
+  // The first pass claims the top level lands and finds how deep the file goes, each further one the next level
+  for (int32_t level = 0; level <= deepest; level++) {
+    int64_t number = 0;
+
+    file.clear();
+    file.seekg(0);
+
+    while (std::getline(file, line)) {
+      number++;
+
+      if (line.empty() || line[0] == '#') continue;
+
+      if (line.compare(0, 2, "id") == 0) {
+        depths = line.find(",depth") != std::string::npos;
+        continue;
+      }
+
+      Row row;
+
+      if (!parseRow(line, depths, row)) {
+        if (level == 0) skip(number);
+        continue;
+      }
+
+      deepest = std::max(deepest, row.level);
+      if (row.level != level) continue;
+
+      if (!place(row, batch)) {
+        skip(number);
+        continue;
+      }
+
+      batch.push_back(std::move(row));
+      if (batch.size() < kBatchLands) continue;
+
+      claim(batch, report);
+
+      // The journal and the queue hold everything the writer has not stored yet, keep them small
+      if (!LandManager::WaitForWriter(kMaxBacklog, kWriterTimeout)) {
+        LOGE("[LM] Import of %s stopped after %d lands, the writer is not keeping up") % path % report.lands;
+        return "[Zonas] La base de datos no responde, la importacion se detuvo.";
+      }
+    }
+
+    if (!batch.empty()) claim(batch, report);
+  }
+
+  LOGI("[LM] Imported %d lands and %d trusts from %s, skipped %d rows") % report.lands % report.trusts % path %
+      report.skipped;
+  return {};
+}
+
+std::optional<std::string> LandManager::ExportLands(const std::string &path, TransferReport &report) {
+  if (!LandManager::WaitForWriter(0, kWriterTimeout)) {
+    return "[Zonas] La base de datos esta ocupada, intenta de nuevo mas tarde.";
+  }
+
+  std::FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) return "[Zonas] No se pudo abrir el archivo " + path + ".";
+
+  BOOST_SCOPE_EXIT_ALL(&) { std::fclose(file); };
+
+  std::fputs("id,owner,dim,x1,y1,z1,x2,y2,z2,depth,trusted\n", file);
+
+  try {
+    SQLite::Statement stmt{
+        *landDB, "SELECT l.id, l.owner, l.dim, l.x1, l.y1, l.z1, l.x2, l.y2, l.z2, l.depth, "
+                 "(SELECT group_concat(t.xuid, ' ') FROM trusts t WHERE t.land = l.id), "
+                 "(SELECT COUNT(*) FROM trusts t WHERE t.land = l.id) FROM lands l ORDER BY l.id"};
+
+    while (stmt.executeStep()) {
+      std::fprintf(
+          file, "%lld,%lld,%d,%d,%d,%d,%d,%d,%d,%d,%s\n", (long long) stmt.getColumn(0).getInt64(),
+          (long long) stmt.getColumn(1).getInt64(), stmt.getColumn(2).getInt(), stmt.getColumn(3).getInt(),
+          stmt.getColumn(4).getInt(), stmt.getColumn(5).getInt(), stmt.getColumn(6).getInt(),
+          stmt.getColumn(7).getInt(), stmt.getColumn(8).getInt(), stmt.getColumn(9).getInt(),
+          stmt.getColumn(10).getText(""));
+
+      report.lands++;
+      report.trusts += stmt.getColumn(11).getInt64();
+    }
+  } catch (SQLite::Exception const &ex) {
+    LOGE("[LM] Failed to export lands to %s: %s") % path % ex.what();
+    return "[Zonas] Ocurrio un error al exportar las zonas.";
+  }
+
+  if (std::fflush(file) != 0 || std::ferror(file)) return "[Zonas] No se pudo escribir el archivo " + path + ".";
+
+  LOGI("[LM] Exported %d lands and %d trusts to %s") % report.lands % report.trusts % path;
+  return {};
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <optional>
+
+// Bulk copies of the lands table to and from CSV files, one land per line:
+//
+//   id,owner,dim,x1,y1,z1,x2,y2,z2,depth,trusted
+//
+// where depth is how many lands the land is nested in and trusted a space separated list of xuids. Files are streamed
+// a line at a time, so memory use does not grow with their size. Lines starting with '#' are ignored, and so is the
+// header line, except that files written before lands could nest have no depth column and a header without it.
+struct TransferReport {
+  int64_t lands   = 0;
+  int64_t trusts  = 0;
+  int64_t skipped = 0;
+
+  // Line number of the first row that was skipped, 0 if none was
+  int64_t firstSkipped = 0;
+};
+
+namespace LandManager {
+// Claims every land in the file that is well formed and fits with what is already claimed, including earlier rows,
+// under the same rule as buying one: every land it cuts into must hold it whole, and it is nested in the deepest of
+// those. The file is read once per depth so parents are claimed before the lands nested in them, the depth stored
+// for a land is worked out again. Imported lands get new ids, the id column is only kept for reference. Limits,
+// prices and who owns the enclosing land do not apply.
+std::optional<std::string> ImportLands(const std::string &path, TransferReport &report);
+
+// Writes every stored land once the writer has caught up
+std::optional<std::string> ExportLands(const std::string &path, TransferReport &report);
+} // namespace LandManager